@@ -0,0 +1,118 @@
+//
+//  BloomFilter.h
+//  Gee-nomics
+//
+
+#ifndef BLOOMFILTER_INCLUDED
+#define BLOOMFILTER_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+// BLOOM FILTERS
+//
+// A BloomFilter answers "might this key have been inserted?" in a few
+// bits per key. It never says no to a key that was inserted, but says
+// yes to a small fraction of keys that weren't.
+//
+// This is a split block Bloom filter. Each key touches one 32 byte
+// block, so a probe costs at most one cache miss, and sets one bit in
+// each of the block's eight 32 bit words. The eight words are handled
+// the same way with different constants, a loop compilers turn into a
+// handful of vector instructions.
+
+const int BLOOM_BLOCK_WORDS = 8;
+
+class BloomFilter
+{
+public:
+    BloomFilter(long long expectedKeys, int bitsPerKey);
+    // Sizes the filter for about expectedKeys keys. More bits per key
+    // means fewer false positives: 8 gives about 3%, 10 about 1.3%
+    
+    static uint64_t hash(const char* key, int length);
+    // The hash insert() and mayContain() take for a key. Computing it
+    // once lets a key be probed against many filters cheaply
+    
+    void insert(uint64_t keyHash);
+    bool mayContain(uint64_t keyHash) const;
+
+private:
+    vector<uint32_t>    m_words;        // BLOOM_BLOCK_WORDS per block
+    uint64_t            m_numBlocks;
+    
+    uint64_t block(uint64_t keyHash) const;
+    static void lanes(uint64_t keyHash, uint32_t mask[BLOOM_BLOCK_WORDS]);
+};
+
+inline BloomFilter::BloomFilter(long long expectedKeys, int bitsPerKey)
+{
+    long long bits = max<long long>(1, expectedKeys) * max(1, bitsPerKey);
+    m_numBlocks = (bits + 32 * BLOOM_BLOCK_WORDS - 1) / (32 * BLOOM_BLOCK_WORDS);
+    m_words.assign(m_numBlocks * BLOOM_BLOCK_WORDS, 0);
+}
+
+inline uint64_t BloomFilter::hash(const char* key, int length)
+{
+    // FNV-1a, then a finalizer so that every bit depends on every
+    // character. FNV alone leaves the high bits, which pick the block,
+    // poorly mixed for short keys
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < length; i++)
+    {
+        h ^= static_cast<unsigned char>(key[i]);
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Index in m_words of the block keyHash falls in, chosen by its high 32 bits
+inline uint64_t BloomFilter::block(uint64_t keyHash) const
+{
+    return (((keyHash >> 32) * m_numBlocks) >> 32) * BLOOM_BLOCK_WORDS;
+}
+
+// The bit keyHash sets in each word of its block, chosen by its low 32 bits
+inline void BloomFilter::lanes(uint64_t keyHash, uint32_t mask[BLOOM_BLOCK_WORDS])
+{
+    static const uint32_t SALT[BLOOM_BLOCK_WORDS] = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+    };
+    uint32_t h = static_cast<uint32_t>(keyHash);
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        mask[i] = 1U << ((h * SALT[i]) >> 27);
+}
+
+inline void BloomFilter::insert(uint64_t keyHash)
+{
+    uint32_t mask[BLOOM_BLOCK_WORDS];
+    lanes(keyHash, mask);
+    uint32_t* words = &m_words[block(keyHash)];
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        words[i] |= mask[i];
+}
+
+inline bool BloomFilter::mayContain(uint64_t keyHash) const
+{
+    uint32_t mask[BLOOM_BLOCK_WORDS];
+    lanes(keyHash, mask);
+    const uint32_t* words = &m_words[block(keyHash)];
+    
+    // Check every lane rather than stopping at the first miss, so the
+    // loop has no branches to get in the way of vectorizing it
+    uint32_t missing = 0;
+    for (int i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        missing |= mask[i] & ~words[i];
+    return missing == 0;
+}
+
+#endif // BLOOMFILTER_INCLUDED
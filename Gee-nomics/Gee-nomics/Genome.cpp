@@ -11,9 +11,9 @@ class GenomeImpl
 public:
     GenomeImpl(const string& nm, const string& sequence);
     static bool load(istream& genomeSource, vector<Genome>& genomes);
-    int length() const;
+    long long length() const;
     string name() const;
-    bool extract(int position, int length, string& fragment) const;
+    bool extract(long long position, long long length, string& fragment) const;
 private:
     // We assume
     //  - sequence contains at least one character
@@ -104,7 +104,7 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
     return true;
 }
 
-int GenomeImpl::length() const
+long long GenomeImpl::length() const
 {
     return m_sequence.length();
 }
@@ -117,7 +117,7 @@ string GenomeImpl::name() const
 // Allows user to extract a portion of the genome's sequence
 // starting at a position, and running a certain length.
 // Returns true if extraction was successful, false otherwise
-bool GenomeImpl::extract(int position, int length, string& fragment) const
+bool GenomeImpl::extract(long long position, long long length, string& fragment) const
 {
     if (position < 0 || position >= m_sequence.length())
         return false;
@@ -127,7 +127,9 @@ bool GenomeImpl::extract(int position, int length, string& fragment) const
     if (position + length > m_sequence.length())
         return false;
     
-    fragment = m_sequence.substr(position, length);
+    // Copy into fragment's own memory, so a caller reusing fragment
+    // doesn't allocate once it is big enough
+    fragment.assign(m_sequence, position, length);
     
     return true;
 }
@@ -165,7 +167,7 @@ bool Genome::load(istream& genomeSource, vector<Genome>& genomes)
     return GenomeImpl::load(genomeSource, genomes);
 }
 
-int Genome::length() const
+long long Genome::length() const
 {
     return m_impl->length();
 }
@@ -175,7 +177,7 @@ string Genome::name() const
     return m_impl->name();
 }
 
-bool Genome::extract(int position, int length, string& fragment) const
+bool Genome::extract(long long position, long long length, string& fragment) const
 {
     return m_impl->extract(position, length, fragment);
 }
@@ -0,0 +1,426 @@
+//
+//  GenomeFile.cpp
+//  Gee-nomics
+//
+
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <streambuf>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+using namespace std;
+
+// COMPRESSED GENOME FILES
+//
+// A gzip file is one or more members, each a header, deflated data, and
+// a trailer holding the CRC and length of the data before it was
+// deflated. Deflated data refers back to what came before it in the
+// member, so a plain gzip file is inflated from start to end on the
+// thread reading it.
+//
+// BGZF is gzip whose members, or blocks, each hold at most 64 KB and
+// give their compressed size in an extra field of the header, so where
+// each block starts is known without inflating the ones before it.
+// Threads take turns reading the next block from the file, then inflate
+// it while other threads read and inflate the blocks after it. The
+// stream takes the blocks back in order. At most BGZF_BLOCKS_PER_THREAD
+// blocks per thread are held ahead of the stream, so a reader that falls
+// behind holds the threads up rather than filling memory.
+
+// Bytes read from the file, or inflated, at a time
+const int READ_CHUNK_BYTES = 1 << 16;
+
+const int BGZF_BLOCKS_PER_THREAD = 4;
+
+// A BGZF block's header is a gzip header with one extra subfield, 'BC',
+// holding the size of the whole block less one
+const int BGZF_HEADER_BYTES = 18;
+const int GZIP_TRAILER_BYTES = 8;
+const int BGZF_MAX_BLOCK_BYTES = 1 << 16;
+
+enum class Compression
+{
+    None,
+    Gzip,
+    Bgzf
+};
+
+// A block of a BGZF file, from when a thread reads it until the stream
+// takes its data
+struct BgzfBlock
+{
+    BgzfBlock() : ready(false), ok(true) {}
+    string  compressed;     // the whole block, header and trailer included
+    string  data;
+    bool    ready;          // inflated, or found to be damaged
+    bool    ok;
+};
+
+class GenomeFileImpl : public streambuf
+{
+public:
+    GenomeFileImpl(const string& filename, int decompressThreads, istream& stream);
+    ~GenomeFileImpl();
+    bool isOpen() const;
+protected:
+    int_type underflow();
+private:
+    ifstream    m_file;
+    istream&    m_stream;           // the GenomeFile reading through this buffer
+    Compression m_compression;
+    string      m_data;             // what the stream is reading
+    
+    // Gzip
+    z_stream    m_inflater;
+    bool        m_inflaterStarted;
+    bool        m_inMember;         // part way through a member
+    string      m_input;
+    
+    // BGZF. m_mutex guards everything but the data of blocks being inflated
+    mutex                       m_mutex;
+    condition_variable          m_blockReady;
+    condition_variable          m_roomFree;
+    map<long long, BgzfBlock>   m_blocks;       // by number, read but not yet taken by the stream
+    long long                   m_blocksRead;
+    long long                   m_nextBlock;    // the next the stream takes
+    int                         m_maxBlocksAhead;
+    bool                        m_endOfBlocks;  // at the end of the file, or a damaged block
+    bool                        m_stopping;
+    vector<thread>              m_threads;
+    
+    bool fillPlain();
+    bool fillGzip();
+    bool fillBgzf();
+    bool readBlock(BgzfBlock& block);
+    void inflateBlocks();
+    void fail();
+};
+
+bool isBgzfHeader(const unsigned char* header);
+void inflateBlock(BgzfBlock& block);
+unsigned long littleEndian(const unsigned char* bytes, int n);
+
+GenomeFileImpl::GenomeFileImpl(const string& filename, int decompressThreads, istream& stream)
+: m_file(filename, ios::binary), m_stream(stream), m_compression(Compression::None), m_inflaterStarted(false), m_inMember(false),
+  m_blocksRead(0), m_nextBlock(0), m_maxBlocksAhead(0), m_endOfBlocks(false), m_stopping(false)
+{
+    if (!m_file)
+        return;
+    
+    // Tell what the file is from its first bytes, whatever its name
+    unsigned char header[BGZF_HEADER_BYTES];
+    m_file.read(reinterpret_cast<char*>(header), BGZF_HEADER_BYTES);
+    long long got = m_file.gcount();
+    m_file.clear();
+    m_file.seekg(0);
+    
+    if (got == BGZF_HEADER_BYTES && isBgzfHeader(header))
+        m_compression = Compression::Bgzf;
+    else if (got >= 2 && header[0] == 0x1f && header[1] == 0x8b)
+        m_compression = Compression::Gzip;
+    
+    if (m_compression == Compression::Gzip)
+    {
+        memset(&m_inflater, 0, sizeof(m_inflater));
+        
+        // 16 more window bits to expect a gzip header and trailer
+        m_inflaterStarted = inflateInit2(&m_inflater, 15 + 16) == Z_OK;
+        if (!m_inflaterStarted)
+            m_file.close();
+    }
+    else if (m_compression == Compression::Bgzf)
+    {
+        int numThreads = decompressThreads > 0 ? decompressThreads : max<int>(1, thread::hardware_concurrency());
+        m_maxBlocksAhead = BGZF_BLOCKS_PER_THREAD * numThreads;
+        for (int t = 0; t < numThreads; t++)
+            m_threads.push_back(thread(&GenomeFileImpl::inflateBlocks, this));
+    }
+}
+
+// Blocks being inflated are finished, and no more are started
+GenomeFileImpl::~GenomeFileImpl()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_roomFree.notify_all();
+    for (int t = 0; t < m_threads.size(); t++)
+        m_threads[t].join();
+    
+    if (m_inflaterStarted)
+        inflateEnd(&m_inflater);
+}
+
+bool GenomeFileImpl::isOpen() const
+{
+    return m_file.is_open();
+}
+
+GenomeFileImpl::int_type GenomeFileImpl::underflow()
+{
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+    
+    // A fill can come up empty before the end, as an empty member does
+    m_data.clear();
+    while (m_data.empty())
+    {
+        bool filled;
+        if (m_compression == Compression::Bgzf)
+            filled = fillBgzf();
+        else if (m_compression == Compression::Gzip)
+            filled = fillGzip();
+        else
+            filled = fillPlain();
+        
+        if (!filled)
+        {
+            setg(nullptr, nullptr, nullptr);
+            return traits_type::eof();
+        }
+    }
+    
+    setg(&m_data[0], &m_data[0], &m_data[0] + m_data.size());
+    return traits_type::to_int_type(m_data[0]);
+}
+
+// Each fill puts the next of the file's data in m_data, returning false
+// at the end of the file or once the stream has been failed
+
+bool GenomeFileImpl::fillPlain()
+{
+    m_data.resize(READ_CHUNK_BYTES);
+    m_file.read(&m_data[0], READ_CHUNK_BYTES);
+    m_data.resize(m_file.gcount());
+    if (!m_data.empty())
+        return true;
+    
+    if (m_file.bad())
+        fail();
+    return false;
+}
+
+// Inflates as much as fits in one chunk, going on to the next member
+// whenever one ends
+bool GenomeFileImpl::fillGzip()
+{
+    m_data.resize(READ_CHUNK_BYTES);
+    m_inflater.next_out = reinterpret_cast<Bytef*>(&m_data[0]);
+    m_inflater.avail_out = READ_CHUNK_BYTES;
+    
+    while (m_inflater.avail_out > 0)
+    {
+        if (m_inflater.avail_in == 0)
+        {
+            m_input.resize(READ_CHUNK_BYTES);
+            m_file.read(&m_input[0], READ_CHUNK_BYTES);
+            if (m_file.gcount() == 0)
+                break;
+            m_inflater.next_in = reinterpret_cast<Bytef*>(&m_input[0]);
+            m_inflater.avail_in = m_file.gcount();
+        }
+        
+        int status = inflate(&m_inflater, Z_NO_FLUSH);
+        if (status == Z_STREAM_END)
+        {
+            inflateReset(&m_inflater);
+            m_inMember = false;
+        }
+        else if (status == Z_OK)
+            m_inMember = true;
+        else
+        {
+            fail();
+            return false;
+        }
+    }
+    
+    m_data.resize(READ_CHUNK_BYTES - m_inflater.avail_out);
+    if (!m_data.empty())
+        return true;
+    
+    // The file ended, which it mustn't part way through a member
+    if (m_inMember || m_file.bad())
+        fail();
+    return false;
+}
+
+// Takes the next block from the threads, waiting for it if need be
+bool GenomeFileImpl::fillBgzf()
+{
+    unique_lock<mutex> lock(m_mutex);
+    
+    map<long long, BgzfBlock>::iterator it;
+    for (;;)
+    {
+        it = m_blocks.find(m_nextBlock);
+        if (it != m_blocks.end() && it->second.ready)
+            break;
+        if (it == m_blocks.end() && m_endOfBlocks)
+            return false;
+        m_blockReady.wait(lock);
+    }
+    
+    if (!it->second.ok)
+    {
+        fail();
+        return false;
+    }
+    
+    m_data.swap(it->second.data);
+    m_blocks.erase(it);
+    m_nextBlock++;
+    m_roomFree.notify_all();
+    return true;
+}
+
+// Reads the next block's bytes, leaving it not ok if it isn't a whole
+// BGZF block. Returns false at the end of the file. m_mutex must be held
+bool GenomeFileImpl::readBlock(BgzfBlock& block)
+{
+    unsigned char header[BGZF_HEADER_BYTES];
+    m_file.read(reinterpret_cast<char*>(header), BGZF_HEADER_BYTES);
+    long long got = m_file.gcount();
+    if (got == 0 && !m_file.bad())
+        return false;
+    
+    int size = got == BGZF_HEADER_BYTES && isBgzfHeader(header) ? littleEndian(header + 16, 2) + 1 : 0;
+    if (size < BGZF_HEADER_BYTES + GZIP_TRAILER_BYTES)
+    {
+        block.ok = false;
+        return true;
+    }
+    
+    block.compressed.assign(reinterpret_cast<char*>(header), BGZF_HEADER_BYTES);
+    block.compressed.resize(size);
+    m_file.read(&block.compressed[BGZF_HEADER_BYTES], size - BGZF_HEADER_BYTES);
+    if (m_file.gcount() < size - BGZF_HEADER_BYTES)
+        block.ok = false;
+    return true;
+}
+
+// Body of each of the threads inflating a BGZF file
+void GenomeFileImpl::inflateBlocks()
+{
+    unique_lock<mutex> lock(m_mutex);
+    
+    for (;;)
+    {
+        while (!m_stopping && !m_endOfBlocks && m_blocksRead - m_nextBlock >= m_maxBlocksAhead)
+            m_roomFree.wait(lock);
+        
+        if (m_stopping || m_endOfBlocks)
+            return;
+        
+        // Blocks stay where they are in the map as others come and go,
+        // so this one can be inflated without the lock
+        long long number = m_blocksRead;
+        BgzfBlock& block = m_blocks[number];
+        if (!readBlock(block))
+        {
+            m_blocks.erase(number);
+            m_endOfBlocks = true;
+            m_blockReady.notify_all();
+            return;
+        }
+        m_blocksRead++;
+        
+        // Nothing after a damaged block can be trusted
+        if (!block.ok)
+            m_endOfBlocks = true;
+        
+        lock.unlock();
+        inflateBlock(block);
+        lock.lock();
+        
+        block.ready = true;
+        m_blockReady.notify_all();
+    }
+}
+
+// Marks the stream bad where the file stopped making sense
+void GenomeFileImpl::fail()
+{
+    m_stream.setstate(ios::badbit);
+}
+
+bool isBgzfHeader(const unsigned char* header)
+{
+    return header[0] == 0x1f && header[1] == 0x8b && header[2] == Z_DEFLATED && (header[3] & 4) != 0 &&
+           littleEndian(header + 10, 2) == 6 && header[12] == 'B' && header[13] == 'C' && littleEndian(header + 14, 2) == 2;
+}
+
+// Inflates a block that readBlock() left ok, and checks what comes out
+// against the block's trailer
+void inflateBlock(BgzfBlock& block)
+{
+    if (!block.ok)
+        return;
+    
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(block.compressed.data());
+    size_t size = block.compressed.size();
+    unsigned long crc = littleEndian(bytes + size - GZIP_TRAILER_BYTES, 4);
+    unsigned long length = littleEndian(bytes + size - 4, 4);
+    if (length > BGZF_MAX_BLOCK_BYTES)
+    {
+        block.ok = false;
+        return;
+    }
+    
+    // The block's deflated data has no header of its own
+    z_stream inflater;
+    memset(&inflater, 0, sizeof(inflater));
+    if (inflateInit2(&inflater, -15) != Z_OK)
+    {
+        block.ok = false;
+        return;
+    }
+    
+    char empty;
+    block.data.resize(length);
+    inflater.next_in = const_cast<Bytef*>(bytes + BGZF_HEADER_BYTES);
+    inflater.avail_in = size - BGZF_HEADER_BYTES - GZIP_TRAILER_BYTES;
+    inflater.next_out = reinterpret_cast<Bytef*>(length > 0 ? &block.data[0] : &empty);
+    inflater.avail_out = length;
+    
+    int status = inflate(&inflater, Z_FINISH);
+    block.ok = status == Z_STREAM_END && inflater.total_out == length &&
+               crc32(0, reinterpret_cast<const Bytef*>(block.data.data()), length) == crc;
+    inflateEnd(&inflater);
+    
+    string().swap(block.compressed);
+}
+
+unsigned long littleEndian(const unsigned char* bytes, int n)
+{
+    unsigned long value = 0;
+    for (int i = n - 1; i >= 0; i--)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+//******************** GenomeFile functions ********************************
+
+// These functions simply delegate to GenomeFileImpl's functions.
+
+GenomeFile::GenomeFile(const string& filename, int decompressThreads)
+: istream(nullptr)
+{
+    m_impl = new GenomeFileImpl(filename, decompressThreads, *this);
+    rdbuf(m_impl);
+    if (!m_impl->isOpen())
+        setstate(ios::failbit);
+}
+
+GenomeFile::~GenomeFile()
+{
+    delete m_impl;
+}
@@ -8,229 +8,2347 @@
 
 #include "provided.h"
 #include "Trie.h"
+#include "SeedFile.h"
+#include "Posting.h"
+#include "BloomFilter.h"
+#include "KmerCounter.h"
 #include <string>
 #include <utility>
 #include <vector>
 #include <list>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <unordered_map>
 #include <algorithm>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
 using namespace std;
 
+// THE LIBRARY INDEX
+//
+// Queries never lock. The library is published as an immutable
+// LibraryVersion that a query grabs once and uses for its whole run,
+// so it sees a consistent library even while genomes are being added.
+//
+// A version is a list of segments, each an immutable run of consecutive
+// genomes with its own index. addGenome() publishes a new version with
+// one extra small segment (the delta) instead of touching anything a
+// query might be reading, and a background thread merges neighbouring
+// segments so queries do not have to search too many of them.
+//
+// Versions and segments are reference counted, so an old version is
+// freed when the last query using it finishes.
+//
+// A segment built by addGenomesFromFile() keeps its index in a SeedFile
+// on disk instead of a Trie. Such segments are never merged, so the
+// segments before them aren't either.
+
+struct IndexSegment
+{
+    IndexSegment(int maxSeedOccurrences)
+    : firstGenome(0), bases(0), ambiguousSeedsSkipped(0), index(maxSeedOccurrences)
+    {}
+    
+    // The index lookups, from whichever of index and seedFile is in use
+    long long count(const string& seed, bool prefix) const;
+    void find(const string& seed, bool exactMatchOnly, vector<Posting>& postings, bool prefix) const;
+    void findBatch(const vector<string>& seeds, bool exactMatchOnly,
+                   vector<vector<Posting>>& postings, bool prefix) const;
+    template<typename Visitor>
+    void visitKeys(Visitor visit) const;
+    
+    // Sets genome to the index in genomes of the genome posting is in,
+    // and position to where in that genome it is
+    void locate(const Posting& posting, int& genome, long long& position) const;
+    
+    int                                 firstGenome;    // library index of genomes[0]
+    long long                           bases;          // total length of genomes
+    long long                           ambiguousSeedsSkipped;
+    vector<shared_ptr<const Genome>>    genomes;
+    vector<string>                      names;          // of genomes, for matches to point at
+    vector<long long>                   genomeStarts;   // offset of each genome's first base
+    
+    // filters[g] holds the seeds of genomes[g], cut to the filter length.
+    // Empty if the library isn't filtered
+    vector<shared_ptr<const BloomFilter>>   filters;
+    
+    // index is empty if the postings are in seedFile instead
+    Trie<Posting, DNAAlphabet>          index;
+    unique_ptr<SeedFile>                seedFile;
+};
+
+long long IndexSegment::count(const string& seed, bool prefix) const
+{
+    return seedFile ? seedFile->count(seed, prefix) : index.count(seed, prefix);
+}
+
+void IndexSegment::find(const string& seed, bool exactMatchOnly, vector<Posting>& postings, bool prefix) const
+{
+    if (seedFile)
+        seedFile->find(seed, exactMatchOnly, postings, prefix);
+    else
+        index.find(seed, exactMatchOnly, postings, prefix);
+}
+
+void IndexSegment::findBatch(const vector<string>& seeds, bool exactMatchOnly,
+                             vector<vector<Posting>>& postings, bool prefix) const
+{
+    if (seedFile)
+        seedFile->findBatch(seeds, exactMatchOnly, postings, prefix);
+    else
+        index.findBatch(seeds, exactMatchOnly, postings, prefix);
+}
+
+template<typename Visitor>
+void IndexSegment::visitKeys(Visitor visit) const
+{
+    if (seedFile)
+        seedFile->visitKeys(visit);
+    else
+        index.visitKeys(visit);
+}
+
+void IndexSegment::locate(const Posting& posting, int& genome, long long& position) const
+{
+    // The genome is the last one starting at or before the offset
+    long long offset = posting.offset();
+    genome = upper_bound(genomeStarts.begin(), genomeStarts.end(), offset) - genomeStarts.begin() - 1;
+    position = offset - genomeStarts[genome];
+}
+
+struct LibraryVersion
+{
+    LibraryVersion() : numGenomes(0) {}
+    
+    // Genome with library index i, for 0 <= i < numGenomes
+    const Genome& genome(int i) const;
+    
+    int                                     numGenomes;
+    vector<shared_ptr<const IndexSegment>>  segments;
+};
+
+const Genome& LibraryVersion::genome(int i) const
+{
+    // Segments are in library order, so find the last one starting at or before i
+    int lo = 0;
+    int hi = segments.size() - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (segments[mid]->firstGenome <= i)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return *segments[lo]->genomes[i - segments[lo]->firstGenome];
+}
+
+// A search checks the clock against its deadline only once in this
+// many checks, since reading the clock costs more than the check
+const int DEADLINE_CHECK_INTERVAL = 64;
+
+// What one search works with, fixed when it starts so that it is
+// unaffected by genomes being added or the search length changing
+struct Search
+{
+    Search() : outcome(QueryStatus::Completed), checks(0) {}
+    
+    // Whether the search should give up now. Once it says so, it keeps
+    // saying so, and outcome says why
+    bool stopped() const;
+    
+    shared_ptr<const LibraryVersion>    library;
+    int                                 searchLength;   // minSearchLength of this search
+    QueryOptions                        limits;
+    mutable QueryStatus                 outcome;
+    mutable int                         checks;
+};
+
+bool Search::stopped() const
+{
+    if (outcome != QueryStatus::Completed)
+        return true;
+    
+    if (limits.cancellation.cancelled())
+        outcome = QueryStatus::Cancelled;
+    else if (limits.deadline != chrono::steady_clock::time_point::max() &&
+             checks++ % DEADLINE_CHECK_INTERVAL == 0 && chrono::steady_clock::now() >= limits.deadline)
+        outcome = QueryStatus::DeadlineExceeded;
+    
+    return outcome != QueryStatus::Completed;
+}
+
+// Best match found so far in one genome. length is 0 if there is none
+struct BestMatch
+{
+    BestMatch() : length(0), position(0) {}
+    
+    int         length;
+    long long   position;
+};
+
+// Buffers a search reuses from fragment to fragment, so that once they
+// have grown to fit, extending seeds into matches allocates nothing
+struct MatchScratch
+{
+    vector<BestMatch>   best;       // by library index, all empty between fragments
+    vector<int>         touched;    // library indexes of the non-empty ones
+    string              dna;        // bases of a genome being compared
+};
+
+// A batch of seeds sampled along a query, and where they are in one
+// segment. Kept from batch to batch, so the buffers are only allocated once
+struct SeedBatch
+{
+    vector<long long>           starts;     // query position of each seed sampled
+    vector<int>                 bySeed;     // seeds of the batch, in order of their bases
+    vector<string>              seeds;      // distinct seeds of the batch
+    vector<int>                 seedOf;     // index in seeds of each seed sampled
+    vector<vector<Posting>>     postings;   // of each distinct seed
+    string                      dna;        // bases of a genome being compared
+};
+
+// A maximal match found in one segment, before its genome is named
+struct SegmentMatch
+{
+    int         genome;         // library index
+    long long   queryPosition;
+    long long   genomePosition;
+    long long   length;
+};
+
+struct QueryContextImpl
+{
+    Search              search;     // made once, so its limits aren't made for every search
+    string              seed;
+    vector<Posting>     postings;
+    vector<string>      variants;           // the seed with its first base replaced
+    vector<Posting>     variantPostings;
+    MatchScratch        scratch;
+    vector<DNAMatchRef> matches;
+};
+
+// Runs asynchronous searches on a fixed set of threads, oldest first.
+// The threads are started by the first search submitted, so a
+// GenomeMatcher that is only searched synchronously doesn't pay for them
+class QueryExecutor
+{
+public:
+    QueryExecutor() : m_stopping(false) {}
+    ~QueryExecutor();
+    void submit(const function<void()>& task);
+private:
+    mutex                       m_mutex;
+    condition_variable          m_taskReady;
+    deque<function<void()>>     m_tasks;
+    bool                        m_stopping;
+    vector<thread>              m_workers;
+    
+    void work();
+};
+
+// Runs whatever is still queued, then stops the threads
+QueryExecutor::~QueryExecutor()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_taskReady.notify_all();
+    for (int i = 0; i < m_workers.size(); i++)
+        m_workers[i].join();
+}
+
+void QueryExecutor::submit(const function<void()>& task)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_workers.empty())
+        {
+            // One thread per core, so searches don't compete for them
+            int numThreads = max<int>(1, thread::hardware_concurrency());
+            for (int i = 0; i < numThreads; i++)
+                m_workers.push_back(thread(&QueryExecutor::work, this));
+        }
+        m_tasks.push_back(task);
+    }
+    m_taskReady.notify_one();
+}
+
+// Body of each of the executor's threads
+void QueryExecutor::work()
+{
+    unique_lock<mutex> lock(m_mutex);
+    
+    for (;;)
+    {
+        while (!m_stopping && m_tasks.empty())
+            m_taskReady.wait(lock);
+        
+        if (m_tasks.empty())
+            return;
+        
+        function<void()> task = m_tasks.front();
+        m_tasks.pop_front();
+        
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+// A genome read by addGenomesFromFiles, waiting to be indexed
+struct ParsedGenome
+{
+    int                         file;
+    int                         record;     // which of the file's genomes
+    shared_ptr<const Genome>    genome;
+};
+
+// Hands parsed genomes from the threads reading files to the threads
+// indexing them. push() waits while the queue is full and pop() while
+// it is empty, until the queue is closed
+class ParsedGenomeQueue
+{
+public:
+    ParsedGenomeQueue(int capacity) : m_capacity(capacity), m_closed(false) {}
+    void push(const ParsedGenome& genome);
+    bool pop(ParsedGenome& genome);
+    // Once closed, pop() returns false when nothing is left
+    void close();
+private:
+    mutex                   m_mutex;
+    condition_variable      m_notFull;
+    condition_variable      m_notEmpty;
+    deque<ParsedGenome>     m_genomes;
+    int                     m_capacity;
+    bool                    m_closed;
+};
+
+void ParsedGenomeQueue::push(const ParsedGenome& genome)
+{
+    {
+        unique_lock<mutex> lock(m_mutex);
+        while (m_genomes.size() >= m_capacity)
+            m_notFull.wait(lock);
+        m_genomes.push_back(genome);
+    }
+    m_notEmpty.notify_one();
+}
+
+bool ParsedGenomeQueue::pop(ParsedGenome& genome)
+{
+    {
+        unique_lock<mutex> lock(m_mutex);
+        while (!m_closed && m_genomes.empty())
+            m_notEmpty.wait(lock);
+        
+        if (m_genomes.empty())
+            return false;
+        
+        genome = m_genomes.front();
+        m_genomes.pop_front();
+    }
+    m_notFull.notify_one();
+    return true;
+}
+
+void ParsedGenomeQueue::close()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_notEmpty.notify_all();
+}
+
+// How far addGenomesFromFiles has got with one file
+struct FileLoadState
+{
+    FileLoadState() : parsed(false), built(0) {}
+    bool                                parsed;     // read to the end, or given up on
+    vector<shared_ptr<IndexSegment>>    segments;   // one per genome parsed, null until built
+    int                                 built;
+};
+
+// A reader may start a file at most this many files per reader past the
+// first file not yet added. Every genome of a file is held until the
+// files before it are added, so this bounds what is held
+const int FILES_AHEAD_PER_READER = 2;
+
+// A segment and all the segments after it are merged into one once the
+// segment is no more than this many times the size of those newer
+// segments combined. This keeps the number of segments logarithmic in
+// the size of the library, and means a base is copied by a merge only
+// a logarithmic number of times
+const int SEGMENT_MERGE_RATIO = 2;
+
 class GenomeMatcherImpl
 {
 public:
-    GenomeMatcherImpl(int minSearchLength);
+    GenomeMatcherImpl(int minSearchLength, const IndexOptions& options);
+    ~GenomeMatcherImpl();
     void addGenome(const Genome& genome);
+    bool addGenomesFromFile(istream& genomeSource, const ExternalBuildOptions& options);
+    bool addGenomesFromFiles(const vector<string>& filenames, const FileLoadOptions& options, vector<FileLoadResult>& results);
     int minimumSearchLength() const;
+    int maximumSearchLength() const;
+    bool setMinimumSearchLength(int minSearchLength);
+    void indexStatistics(IndexStatistics& stats) const;
+    bool countKmers(int k, bool sharedCounts, KmerCounts& counts) const;
     bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, QueryContext& context) const;
+    bool findGenomesWithThisDNA(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<vector<DNAMatch>>& matches) const;
     bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold,
+                            const RelatedGenomesOptions& options, vector<GenomeMatch>& results) const;
+    bool findRelatedGenomes(const vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<vector<GenomeMatch>>& results) const;
+    bool findMaximalMatches(const Genome& query, int minimumLength, vector<MaximalMatch>& matches) const;
+    bool computeSimilarityMatrix(int fragmentMatchLength, bool exactMatchOnly, ostream& output) const;
+    future<DNASearchResult> findGenomesWithThisDNAAsync(const string& fragment, int minimumLength, bool exactMatchOnly,
+                                                        const QueryOptions& options) const;
+    future<RelatedGenomesResult> findRelatedGenomesAsync(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold,
+                                                         const QueryOptions& options) const;
 private:
-    int                           m_minSearchLength;
-    vector<Genome>                m_genomeLibrary;
-    Trie<pair<int, int>>          m_sequencedDNA;
+    atomic<int>                         m_minSearchLength;
+    int                                 m_indexLength;  // longest seed indexed, the maximum search length
+    int                                 m_filterLength; // length of the seeds in the genomes' filters
+    IndexOptions                        m_options;
+    shared_ptr<const LibraryVersion>    m_current;      // only accessed through atomic_load/atomic_store
+    
+    // Writers (addGenome and the merger) take m_writeMutex to build
+    // and publish the next version. Readers never take it
+    mutex                               m_writeMutex;
+    condition_variable                  m_mergeWanted;
+    bool                                m_stopMerging;
+    thread                              m_merger;
+    
+    // Declared last so it is destroyed first, finishing the searches it
+    // was given while everything they use is still there
+    mutable QueryExecutor               m_executor;
+    
+    shared_ptr<const LibraryVersion> snapshot() const;
+    Search startSearch(const QueryOptions& limits = QueryOptions()) const;
+    void publish(const shared_ptr<const LibraryVersion>& version);
+    shared_ptr<IndexSegment> buildSegment(int firstGenome, const vector<shared_ptr<const Genome>>& genomes) const;
+    void addSegments(const vector<shared_ptr<IndexSegment>>& segments);
+    template<typename Visitor>
+    void visitSeeds(const Genome& genome, long long& ambiguousSeedsSkipped, Visitor visit) const;
+    shared_ptr<BloomFilter> newFilter(const Genome& genome) const;
+    void addToFilter(BloomFilter* filter, const string& seed) const;
+    shared_ptr<IndexSegment> mergeSegments(const vector<shared_ptr<const IndexSegment>>& segments) const;
+    bool findMerge(const LibraryVersion& version, int& first) const;
+    void mergeInBackground();
+    
+    bool findGenomesWithThisDNA(const Search& search, const vector<string>& fragments, int minimumLength,
+                                bool exactMatchOnly, vector<vector<DNAMatch>>& matches,
+                                const vector<const vector<char>*>& candidates = vector<const vector<char>*>()) const;
+    int seedOffset(const Search& search, const string& fragment, int minimumLength, string& seed) const;
+    bool usableSeed(const Search& search, const string& seed) const;
+    bool collectMatches(const Search& search, const IndexSegment& segment, const string& fragment, int seedOffset, int minimumLength,
+                        bool exactMatchOnly, const vector<Posting>& matchLocations, const vector<char>* candidates,
+                        MatchScratch& scratch, vector<DNAMatchRef>& matches) const;
+    bool relatedGenomes(const Search& search, const vector<const Genome*>& queries, int fragmentMatchLength, bool exactMatchOnly,
+                        double matchPercentThreshold, vector<vector<GenomeMatch>>& results) const;
+    bool sampleRelatedGenomes(const Search& search, const Genome& query, int fragmentMatchLength, bool exactMatchOnly,
+                              double matchPercentThreshold, const RelatedGenomesOptions& options, vector<GenomeMatch>& results) const;
+    bool splitQuery(const Search& search, const Genome& query, int fragmentMatchLength, vector<string>& fragments) const;
+    bool slidingRelatedGenomes(const Search& search, const Genome& query, int fragmentMatchLength, bool exactMatchOnly,
+                               double matchPercentThreshold, const RelatedGenomesOptions& options, vector<GenomeMatch>& results) const;
+    template<typename Visitor>
+    void visitSeedBatches(const Search& search, const IndexSegment& segment, const string& bases, int stride, bool exactMatchOnly,
+                          bool ambiguousSeeds, SeedBatch& batch, Visitor visit) const;
+    void scoreWindows(const Search& search, const IndexSegment& segment, const string& query, int fragmentMatchLength,
+                      bool exactMatchOnly, bool lastBatch, SeedBatch& batch, vector<pair<long long, int>>& found,
+                      vector<int>& windowsFound) const;
+    void extendMaximalMatches(const Search& search, const IndexSegment& segment, const string& query, int minimumLength,
+                              SeedBatch& batch, unordered_map<long long, long long>& matchEnds,
+                              vector<SegmentMatch>& matches) const;
+    bool prefilterGenomes(const Search& search, const vector<string>& fragments, int fragmentMatchLength, bool exactMatchOnly,
+                          double matchPercentThreshold, vector<char>& candidates, vector<char>& useful) const;
+    void countBatchMatches(const Search& search, vector<string>& fragments, vector<int>& owners,
+                           const vector<vector<char>>& candidates, int fragmentMatchLength,
+                           bool exactMatchOnly, vector<unordered_map<string, int>>& genomeMatches) const;
+    void rankRelatedGenomes(const LibraryVersion& library, unordered_map<string, int>& genomeMatches, long long numSequences,
+                            double matchPercentThreshold, vector<GenomeMatch>& results) const;
 };
 
+// Number of fragments findRelatedGenomes() hands to one batched lookup.
+// Bounds the memory held by the batch's posting lists
+const int FRAGMENT_BATCH_SIZE = 1024;
+
+// A sampled findRelatedGenomes() starts with batches this small, so an
+// answer that is clear early is found without looking up many fragments,
+// and doubles them up to FRAGMENT_BATCH_SIZE
+const int FIRST_SAMPLE_BATCH_SIZE = 64;
+
+// Bases of a genome read at a time while extending a maximal match
+const int EXTEND_CHUNK_BASES = 64;
+
 bool genomeMatchCompare(const GenomeMatch& a, const GenomeMatch& b);
+bool readGenome(istream& genomeSource, vector<Genome>& genomes);
+int matchLength(const Genome& genome, long long position, const string& fragment, bool exactMatchOnly, string& dna);
+void firstBaseVariants(const string& seed, vector<string>& variants);
+
+GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength, const IndexOptions& options)
+: m_minSearchLength(minSearchLength), m_indexLength(max(minSearchLength, options.maxSearchLength)),
+  m_filterLength(minSearchLength), m_options(options), m_current(make_shared<LibraryVersion>()), m_stopMerging(false)
+{
+    m_merger = thread(&GenomeMatcherImpl::mergeInBackground, this);
+}
+
+GenomeMatcherImpl::~GenomeMatcherImpl()
+{
+    {
+        lock_guard<mutex> lock(m_writeMutex);
+        m_stopMerging = true;
+    }
+    m_mergeWanted.notify_one();
+    m_merger.join();
+}
+
+shared_ptr<const LibraryVersion> GenomeMatcherImpl::snapshot() const
+{
+    return atomic_load(&m_current);
+}
+
+Search GenomeMatcherImpl::startSearch(const QueryOptions& limits) const
+{
+    Search search;
+    search.library = snapshot();
+    search.searchLength = m_minSearchLength;
+    search.limits = limits;
+    return search;
+}
+
+// Makes version the one new queries see. Caller must hold m_writeMutex
+void GenomeMatcherImpl::publish(const shared_ptr<const LibraryVersion>& version)
+{
+    atomic_store(&m_current, version);
+    m_mergeWanted.notify_one();
+}
+
+void GenomeMatcherImpl::addGenome(const Genome& genome)
+{
+    vector<shared_ptr<const Genome>> genomes(1, make_shared<Genome>(genome));
+    
+    lock_guard<mutex> lock(m_writeMutex);
+    
+    // The new genome gets a segment of its own, so the current version's
+    // segments are shared with the next version rather than modified
+    shared_ptr<const LibraryVersion> cur = snapshot();
+    shared_ptr<LibraryVersion> next = make_shared<LibraryVersion>(*cur);
+    next->segments.push_back(buildSegment(cur->numGenomes, genomes));
+    next->numGenomes++;
+    
+    publish(next);
+}
+
+shared_ptr<IndexSegment> GenomeMatcherImpl::buildSegment(int firstGenome, const vector<shared_ptr<const Genome>>& genomes) const
+{
+    shared_ptr<IndexSegment> segment = make_shared<IndexSegment>(m_options.maxSeedOccurrences);
+    segment->firstGenome = firstGenome;
+    segment->genomes = genomes;
+    
+    for (int g = 0; g < genomes.size(); g++)
+    {
+        const Genome& genome = *genomes[g];
+        long long start = segment->bases;
+        segment->genomeStarts.push_back(start);
+        segment->names.push_back(genome.name());
+        segment->bases += genome.length();
+        
+        shared_ptr<BloomFilter> filter = newFilter(genome);
+        if (filter)
+            segment->filters.push_back(filter);
+        
+        visitSeeds(genome, segment->ambiguousSeedsSkipped, [&](const string& substring, long long i)
+        {
+            addToFilter(filter.get(), substring);
+            
+            // We create a value for that sequence representing where in
+            // the segment's genomes, laid end to end, it was found
+            Posting posting(start + i);
+            
+            // Insert the search key seqeunce and posting into our Trie
+            segment->index.insert(substring, posting);
+        });
+    }
+    
+    return segment;
+}
+
+// An empty filter sized for genome's seeds, or nullptr if genomes aren't filtered
+shared_ptr<BloomFilter> GenomeMatcherImpl::newFilter(const Genome& genome) const
+{
+    if (m_options.filterBitsPerSeed <= 0)
+        return nullptr;
+    return make_shared<BloomFilter>(genome.length(), m_options.filterBitsPerSeed);
+}
+
+// Adds an indexed seed to its genome's filter. Only the first
+// m_filterLength bases go in, since no search uses fewer
+void GenomeMatcherImpl::addToFilter(BloomFilter* filter, const string& seed) const
+{
+    if (filter != nullptr && seed.size() >= m_filterLength)
+        filter->insert(BloomFilter::hash(seed.data(), m_filterLength));
+}
+
+// Calls visit(seed, position) for every seed of genome that is indexed
+template<typename Visitor>
+void GenomeMatcherImpl::visitSeeds(const Genome& genome, long long& ambiguousSeedsSkipped, Visitor visit) const
+{
+    // We sequence the genome's DNA by the maximum search length, so a
+    // search of any shorter length finds its seed as a prefix. Windows
+    // near the end of the genome are shorter, but are still indexed for
+    // searches short enough to use them
+    for (long long i = 0; i < genome.length(); i++)
+    {
+        string substring = "error";
+        genome.extract(i, min<long long>(m_indexLength, genome.length() - i), substring);
+        
+        if (substring == "error")
+            break;
+        
+        // A seed with an unknown base says nothing useful about where
+        // a fragment came from, and runs of N would make huge posting
+        // lists, so the window is cut short at the first N
+        if (m_options.skipAmbiguousSeeds && substring.find('N') != string::npos)
+        {
+            ambiguousSeedsSkipped++;
+            substring.erase(substring.find('N'));
+            if (substring.empty())
+                continue;
+        }
+        
+        visit(substring, i);
+    }
+}
+
+bool GenomeMatcherImpl::addGenomesFromFile(istream& genomeSource, const ExternalBuildOptions& options)
+{
+    // Never write over a file, least of all another segment's index.
+    // The writer only creates the index if there is nothing there yet
+    SeedFileWriter writer(options.indexPath, m_indexLength, options.memoryBudget);
+    if (!writer.created())
+        return false;
+    
+    shared_ptr<IndexSegment> segment = make_shared<IndexSegment>(m_options.maxSeedOccurrences);
+    BuildProgress progress;
+    
+    // Read one genome at a time, so only the seeds not yet spilled and
+    // the genomes themselves are ever in memory
+    vector<Genome> genomes;
+    while (genomeSource.peek() != EOF)
+    {
+        if (!readGenome(genomeSource, genomes) || genomeSource.bad())
+            return false;
+        
+        // Offsets past what a posting holds can't be indexed
+        const Genome& genome = genomes[0];
+        long long start = segment->bases;
+        if (start + genome.length() - 1 > MAX_POSTING_OFFSET)
+            return false;
+        
+        shared_ptr<BloomFilter> filter = newFilter(genome);
+        bool written = true;
+        visitSeeds(genome, segment->ambiguousSeedsSkipped, [&](const string& substring, long long i)
+        {
+            addToFilter(filter.get(), substring);
+            written = written && writer.add(substring, Posting(start + i));
+        });
+        if (!written)
+            return false;
+        
+        segment->genomes.push_back(make_shared<Genome>(genome));
+        segment->names.push_back(genome.name());
+        segment->genomeStarts.push_back(start);
+        if (filter)
+            segment->filters.push_back(filter);
+        segment->bases += genome.length();
+        
+        progress.genomesRead++;
+        progress.basesRead += genome.length();
+        progress.seedsWritten = writer.progress().postingsWritten;
+        progress.runsWritten = writer.progress().runsWritten;
+        if (options.progress)
+            options.progress(progress);
+    }
+    
+    if (genomeSource.bad())
+        return false;
+    if (segment->genomes.empty())
+        return true;
+    
+    bool finished = writer.finish([&](const SeedFileProgress& p)
+    {
+        progress.seedsWritten = p.postingsWritten;
+        progress.runsWritten = p.runsWritten;
+        progress.seedsMerged = p.postingsMerged;
+        if (options.progress)
+            options.progress(progress);
+    });
+    if (!finished)
+        return false;
+    
+    // The writer leaves a finished file behind for the segment, so one
+    // that can't be opened must be removed here
+    segment->seedFile.reset(new SeedFile(m_options.maxSeedOccurrences));
+    if (!segment->seedFile->open(options.indexPath, m_indexLength))
+    {
+        remove(options.indexPath.c_str());
+        return false;
+    }
+    
+    // The genomes go after whatever is in the library by now
+    lock_guard<mutex> lock(m_writeMutex);
+    
+    shared_ptr<const LibraryVersion> cur = snapshot();
+    shared_ptr<LibraryVersion> next = make_shared<LibraryVersion>(*cur);
+    segment->firstGenome = cur->numGenomes;
+    next->segments.push_back(segment);
+    next->numGenomes += segment->genomes.size();
+    
+    publish(next);
+    return true;
+}
+
+// Three stages overlap. Reader threads each take the next file and parse
+// it a genome at a time, queueing each genome as soon as it is parsed.
+// Indexer threads, the calling thread among them, take genomes off the
+// queue and build each a segment of its own. Whichever thread finishes
+// the last genome of the first file not yet added then adds that file's
+// segments, and those of any finished files after it, in file order.
+// A file's segments are only added once the whole file has parsed, so
+// a file that turns out to be improperly formatted adds nothing
+bool GenomeMatcherImpl::addGenomesFromFiles(const vector<string>& filenames, const FileLoadOptions& options, vector<FileLoadResult>& results)
+{
+    int numFiles = filenames.size();
+    results.assign(numFiles, FileLoadResult());
+    for (int f = 0; f < numFiles; f++)
+        results[f].filename = filenames[f];
+    
+    int numReaders = max(1, min(options.readerThreads, numFiles));
+    int numIndexers = options.indexThreads > 0 ? options.indexThreads : max<int>(1, thread::hardware_concurrency());
+    ParsedGenomeQueue queue(max(1, options.maxQueuedGenomes));
+    
+    // loadMutex guards files, results and the files added so far
+    mutex loadMutex;
+    condition_variable fileAdded;
+    vector<FileLoadState> files(numFiles);
+    int nextToAdd = 0;
+    bool allLoaded = true;
+    
+    // Add every finished file that is next in line. loadMutex must be held
+    auto addFinishedFiles = [&]()
+    {
+        int added = nextToAdd;
+        for (; nextToAdd < numFiles; nextToAdd++)
+        {
+            FileLoadState& file = files[nextToAdd];
+            if (!file.parsed || file.built < file.segments.size())
+                break;
+            
+            FileLoadResult& result = results[nextToAdd];
+            if (result.status == FileLoadStatus::Loaded)
+            {
+                addSegments(file.segments);
+                result.genomesAdded = file.segments.size();
+                for (int g = 0; g < file.segments.size(); g++)
+                    result.basesAdded += file.segments[g]->bases;
+            }
+            else
+                allLoaded = false;
+            vector<shared_ptr<IndexSegment>>().swap(file.segments);
+            
+            if (options.fileDone)
+                options.fileDone(result);
+        }
+        if (nextToAdd > added)
+            fileAdded.notify_all();
+    };
+    
+    atomic<int> nextFile(0);
+    atomic<int> readersLeft(numReaders);
+    auto read = [&]()
+    {
+        vector<Genome> genomes;
+        for (int f = nextFile++; f < numFiles; f = nextFile++)
+        {
+            {
+                unique_lock<mutex> lock(loadMutex);
+                while (f >= nextToAdd + FILES_AHEAD_PER_READER * numReaders)
+                    fileAdded.wait(lock);
+            }
+            
+            FileLoadStatus status = FileLoadStatus::Loaded;
+            GenomeFile source(filenames[f]);
+            if (!source)
+                status = FileLoadStatus::CannotOpen;
+            for (int record = 0; status == FileLoadStatus::Loaded && source.peek() != EOF; record++)
+            {
+                if (!readGenome(source, genomes) || source.bad())
+                {
+                    status = source.bad() ? FileLoadStatus::CannotRead : FileLoadStatus::ImproperlyFormatted;
+                    break;
+                }
+                
+                {
+                    lock_guard<mutex> lock(loadMutex);
+                    files[f].segments.push_back(nullptr);
+                }
+                ParsedGenome parsed;
+                parsed.file = f;
+                parsed.record = record;
+                parsed.genome = make_shared<Genome>(genomes[0]);
+                queue.push(parsed);
+            }
+            
+            if (status == FileLoadStatus::Loaded && source.bad())
+                status = FileLoadStatus::CannotRead;
+            
+            lock_guard<mutex> lock(loadMutex);
+            results[f].status = status;
+            files[f].parsed = true;
+            addFinishedFiles();
+        }
+        
+        // The last reader out lets the indexers finish
+        if (--readersLeft == 0)
+            queue.close();
+    };
+    
+    auto index = [&]()
+    {
+        ParsedGenome parsed;
+        while (queue.pop(parsed))
+        {
+            // Numbered when the file is added
+            vector<shared_ptr<const Genome>> genomes(1, parsed.genome);
+            shared_ptr<IndexSegment> segment = buildSegment(0, genomes);
+            
+            lock_guard<mutex> lock(loadMutex);
+            files[parsed.file].segments[parsed.record] = segment;
+            files[parsed.file].built++;
+            addFinishedFiles();
+        }
+    };
+    
+    vector<thread> threads;
+    for (int r = 0; r < numReaders; r++)
+        threads.push_back(thread(read));
+    for (int i = 1; i < numIndexers; i++)
+        threads.push_back(thread(index));
+    index();
+    for (int t = 0; t < threads.size(); t++)
+        threads[t].join();
+    
+    return allLoaded;
+}
+
+// Adds segments, in order, after whatever is in the library by now
+void GenomeMatcherImpl::addSegments(const vector<shared_ptr<IndexSegment>>& segments)
+{
+    if (segments.empty())
+        return;
+    
+    lock_guard<mutex> lock(m_writeMutex);
+    
+    shared_ptr<const LibraryVersion> cur = snapshot();
+    shared_ptr<LibraryVersion> next = make_shared<LibraryVersion>(*cur);
+    for (int i = 0; i < segments.size(); i++)
+    {
+        segments[i]->firstGenome = next->numGenomes;
+        next->segments.push_back(segments[i]);
+        next->numGenomes += segments[i]->genomes.size();
+    }
+    
+    publish(next);
+}
+
+// Reads the next genome in genomeSource into genomes, leaving
+// genomeSource at the start of the genome after it. Returns false
+// if the genome is not properly formatted
+bool readGenome(istream& genomeSource, vector<Genome>& genomes)
+{
+    // Gather the genome's name line and the lines up to the next name
+    // line, then let Genome::load check them just as it checks a file
+    string record;
+    string line;
+    do
+    {
+        if (!getline(genomeSource, line))
+            break;
+        record += line;
+        record += '\n';
+    }
+    while (genomeSource.peek() != '>' && genomeSource.peek() != EOF);
+    
+    istringstream in(record);
+    return Genome::load(in, genomes) && genomes.size() == 1;
+}
+
+// Combines neighbouring segments into one. The merged index is built
+// from the existing indexes, without going back to the genomes
+shared_ptr<IndexSegment> GenomeMatcherImpl::mergeSegments(const vector<shared_ptr<const IndexSegment>>& segments) const
+{
+    shared_ptr<IndexSegment> merged = make_shared<IndexSegment>(m_options.maxSeedOccurrences);
+    merged->firstGenome = segments[0]->firstGenome;
+    
+    for (int i = 0; i < segments.size(); i++)
+    {
+        const IndexSegment& segment = *segments[i];
+        
+        // Each segment's bases are laid after the ones before it
+        long long shift = merged->bases;
+        merged->index.insertAll(segment.index, [shift](const Posting& p) { return Posting(p.offset() + shift); });
+        
+        merged->genomes.insert(merged->genomes.end(), segment.genomes.begin(), segment.genomes.end());
+        merged->names.insert(merged->names.end(), segment.names.begin(), segment.names.end());
+        for (int g = 0; g < segment.genomeStarts.size(); g++)
+            merged->genomeStarts.push_back(segment.genomeStarts[g] + shift);
+        merged->filters.insert(merged->filters.end(), segment.filters.begin(), segment.filters.end());
+        merged->bases += segment.bases;
+        merged->ambiguousSeedsSkipped += segment.ambiguousSeedsSkipped;
+    }
+    
+    return merged;
+}
+
+// Finds the oldest segment that is due to be merged with all the
+// segments after it. Returns false if there is none, otherwise sets
+// first to that segment's index
+bool GenomeMatcherImpl::findMerge(const LibraryVersion& version, int& first) const
+{
+    // Only the segments after the last one on disk can be merged
+    int start = 0;
+    for (int i = 0; i < version.segments.size(); i++)
+    {
+        if (version.segments[i]->seedFile)
+            start = i + 1;
+    }
+    
+    long long newerBases = 0;
+    for (int i = start; i < version.segments.size(); i++)
+        newerBases += version.segments[i]->bases;
+    
+    for (int i = start; i + 1 < version.segments.size(); i++)
+    {
+        newerBases -= version.segments[i]->bases;
+        
+        // A merged segment's offsets must still fit in a posting
+        if (version.segments[i]->bases + newerBases - 1 > MAX_POSTING_OFFSET)
+            continue;
+        if (version.segments[i]->bases <= SEGMENT_MERGE_RATIO * newerBases)
+        {
+            first = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Body of the merger thread
+void GenomeMatcherImpl::mergeInBackground()
+{
+    unique_lock<mutex> lock(m_writeMutex);
+    
+    for (;;)
+    {
+        int first;
+        while (!m_stopMerging && !findMerge(*snapshot(), first))
+            m_mergeWanted.wait(lock);
+        
+        if (m_stopMerging)
+            return;
+        
+        shared_ptr<const LibraryVersion> cur = snapshot();
+        vector<shared_ptr<const IndexSegment>> toMerge(cur->segments.begin() + first, cur->segments.end());
+        
+        // Build the merged index without the lock, so genomes can keep
+        // being added and published in the meantime
+        lock.unlock();
+        shared_ptr<const IndexSegment> merged = mergeSegments(toMerge);
+        lock.lock();
+        
+        // Only the merger removes segments, so the ones we merged are
+        // still in the current version, possibly with new ones after them
+        shared_ptr<LibraryVersion> next = make_shared<LibraryVersion>(*snapshot());
+        next->segments[first] = merged;
+        next->segments.erase(next->segments.begin() + first + 1, next->segments.begin() + first + toMerge.size());
+        
+        publish(next);
+    }
+}
+
+int GenomeMatcherImpl::minimumSearchLength() const
+{
+    return m_minSearchLength;
+}
+
+int GenomeMatcherImpl::maximumSearchLength() const
+{
+    return m_indexLength;
+}
+
+bool GenomeMatcherImpl::setMinimumSearchLength(int minSearchLength)
+{
+    // Any length the index is deep enough for will do. Searches already
+    // running keep the length they started with
+    if (minSearchLength < 1 || minSearchLength > m_indexLength)
+        return false;
+    
+    m_minSearchLength = minSearchLength;
+    return true;
+}
+
+void GenomeMatcherImpl::indexStatistics(IndexStatistics& stats) const
+{
+    stats = IndexStatistics();
+    
+    // Seeds in more than one segment are counted once per segment, so
+    // the figures are exact once the background merges have caught up
+    shared_ptr<const LibraryVersion> library = snapshot();
+    for (int s = 0; s < library->segments.size(); s++)
+    {
+        const IndexSegment& segment = *library->segments[s];
+        stats.ambiguousSeedsSkipped += segment.ambiguousSeedsSkipped;
+        
+        segment.visitKeys([&](int count, const vector<Posting>& postings)
+        {
+            stats.seedsIndexed += count;
+            stats.distinctSeeds++;
+            stats.mostOccurrences = max<long long>(stats.mostOccurrences, count);
+            
+            if (m_options.maxSeedOccurrences > 0 && count > m_options.maxSeedOccurrences)
+            {
+                stats.overRepresentedSeeds++;
+                stats.postingsDropped += count - postings.size();
+            }
+            else
+                stats.longestPostingList = max<long long>(stats.longestPostingList, count);
+        });
+    }
+}
+
+bool GenomeMatcherImpl::countKmers(int k, bool sharedCounts, KmerCounts& counts) const
+{
+    // Count the library as it is now. The snapshot keeps its genomes
+    // alive while we do
+    shared_ptr<const LibraryVersion> library = snapshot();
+    vector<const Genome*> genomes;
+    for (int i = 0; i < library->numGenomes; i++)
+        genomes.push_back(&library->genome(i));
+    
+    return ::countKmers(genomes, k, sharedCounts, max<int>(1, thread::hardware_concurrency()), counts);
+}
+
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+{
+    if (fragment.size() < minimumLength)
+        return false;
+    
+    Search search = startSearch();
+    if (minimumLength < search.searchLength)
+        return false;
+    
+    vector<vector<DNAMatch>> allMatches;
+    bool found = findGenomesWithThisDNA(search, vector<string>(1, fragment), minimumLength, exactMatchOnly, allMatches);
+    matches.swap(allMatches[0]);
+    
+    return found;
+}
+
+// The same steps as the batched search below takes for one fragment,
+// with everything kept in the context
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, QueryContext& context) const
+{
+    QueryContextImpl& c = *context.m_impl;
+    c.matches.clear();
+    c.search.library = snapshot();
+    c.search.searchLength = m_minSearchLength;
+    
+    if (fragment.size() < minimumLength || minimumLength < c.search.searchLength)
+        return false;
+    
+    int offset = seedOffset(c.search, fragment, minimumLength, c.seed);
+    if (offset < 0)
+        return false;
+    
+    bool found = false;
+    const LibraryVersion& library = *c.search.library;
+    for (int s = 0; s < library.segments.size(); s++)
+    {
+        const IndexSegment& segment = *library.segments[s];
+        bool prefix = c.search.searchLength < m_indexLength;
+        segment.find(c.seed, exactMatchOnly, c.postings, prefix);
+        if (!exactMatchOnly && offset > 0)
+        {
+            firstBaseVariants(c.seed, c.variants);
+            for (int v = 0; v < c.variants.size(); v++)
+            {
+                segment.find(c.variants[v], true, c.variantPostings, prefix);
+                c.postings.insert(c.postings.end(), c.variantPostings.begin(), c.variantPostings.end());
+            }
+        }
+        if (collectMatches(c.search, segment, fragment, offset, minimumLength, exactMatchOnly, c.postings, nullptr,
+                           c.scratch, c.matches))
+            found = true;
+    }
+    
+    return found;
+}
+
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<vector<DNAMatch>>& matches) const
+{
+    return findGenomesWithThisDNA(startSearch(), fragments, minimumLength, exactMatchOnly, matches);
+}
+
+// If candidates is not empty, fragments[i] is only looked for in the
+// genomes whose library index is set in *candidates[i]
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const Search& search, const vector<string>& fragments, int minimumLength,
+                                               bool exactMatchOnly, vector<vector<DNAMatch>>& matches,
+                                               const vector<const vector<char>*>& candidates) const
+{
+    matches.clear();
+    matches.resize(fragments.size());
+    
+    if (minimumLength < search.searchLength)
+        return false;
+    
+    const LibraryVersion& library = *search.library;
+    
+    // Pick a seed for every fragment that can match. seedFragments[j] is
+    // the fragment that fragSearchKeys[j] came from, and seedOffsets[j]
+    // where in that fragment it starts. variantKeys[v] is a variant of
+    // fragSearchKeys[variantSeeds[v]] to look up as well
+    vector<string> fragSearchKeys;
+    vector<int> seedFragments;
+    vector<int> seedOffsets;
+    vector<string> variantKeys;
+    vector<int> variantSeeds;
+    vector<string> variants;
+    string seed;
+    for (int i = 0; i < fragments.size(); i++)
+    {
+        if (search.stopped())
+            return false;
+        
+        if (fragments[i].size() < minimumLength)
+            continue;
+        
+        int offset = seedOffset(search, fragments[i], minimumLength, seed);
+        if (offset < 0)
+            continue;
+        
+        if (!exactMatchOnly && offset > 0)
+        {
+            firstBaseVariants(seed, variants);
+            for (int v = 0; v < variants.size(); v++)
+            {
+                variantKeys.push_back(variants[v]);
+                variantSeeds.push_back(fragSearchKeys.size());
+            }
+        }
+        
+        fragSearchKeys.push_back(seed);
+        seedFragments.push_back(i);
+        seedOffsets.push_back(offset);
+    }
+    
+    bool found = false;
+    MatchScratch scratch;
+    vector<DNAMatchRef> segmentMatches;
+    for (int s = 0; s < library.segments.size(); s++)
+    {
+        const IndexSegment& segment = *library.segments[s];
+        
+        // Look up every seed at once so the trie walks overlap. Seeds shorter
+        // than the index's keys match every key they are a prefix of
+        vector<vector<Posting>> matchLocations;
+        bool prefix = search.searchLength < m_indexLength;
+        segment.findBatch(fragSearchKeys, exactMatchOnly, matchLocations, prefix);
+        if (!variantKeys.empty())
+        {
+            vector<vector<Posting>> variantLocations;
+            segment.findBatch(variantKeys, true, variantLocations, prefix);
+            for (int v = 0; v < variantKeys.size(); v++)
+            {
+                vector<Posting>& locations = matchLocations[variantSeeds[v]];
+                locations.insert(locations.end(), variantLocations[v].begin(), variantLocations[v].end());
+            }
+        }
+        
+        for (int j = 0; j < fragSearchKeys.size(); j++)
+        {
+            int i = seedFragments[j];
+            const vector<char>* genomesWanted = candidates.empty() ? nullptr : candidates[i];
+            segmentMatches.clear();
+            if (!collectMatches(search, segment, fragments[i], seedOffsets[j], minimumLength, exactMatchOnly, matchLocations[j],
+                                genomesWanted, scratch, segmentMatches))
+                continue;
+            
+            found = true;
+            for (int m = 0; m < segmentMatches.size(); m++)
+            {
+                DNAMatch d;
+                d.genomeName = *segmentMatches[m].genomeName;
+                d.length = segmentMatches[m].length;
+                d.position = segmentMatches[m].position;
+                matches[i].push_back(d);
+            }
+        }
+    }
+    
+    return found;
+}
+
+// Returns where in fragment to take the minSearchLength bases we look up,
+// leaving them in seed, or -1 if the fragment has no usable seed. We normally
+// use the start of the fragment, but fall back to a later seed if that one is
+// over-represented or ambiguous. The seed must end within the first
+// minimumLength bases so that every match long enough to report covers it
+int GenomeMatcherImpl::seedOffset(const Search& search, const string& fragment, int minimumLength, string& seed) const
+{
+    for (int offset = 0; offset + search.searchLength <= minimumLength; offset++)
+    {
+        seed.assign(fragment, offset, search.searchLength);
+        if (usableSeed(search, seed))
+            return offset;
+    }
+    return -1;
+}
+
+// Whether seed can be used to look up a fragment under the index options
+bool GenomeMatcherImpl::usableSeed(const Search& search, const string& seed) const
+{
+    // Windows containing N were never indexed
+    if (m_options.skipAmbiguousSeeds && seed.find('N') != string::npos)
+        return false;
+    
+    if (m_options.maxSeedOccurrences <= 0)
+        return true;
+    
+    // A repeat is judged by how often it occurs in the whole library,
+    // however the library happens to be split into segments right now
+    const LibraryVersion& library = *search.library;
+    long long occurrences = 0;
+    for (int s = 0; s < library.segments.size(); s++)
+        occurrences += library.segments[s]->count(seed, true);
+    
+    return occurrences <= m_options.maxSeedOccurrences;
+}
+
+// Lookups that allow a mismatch never allow it in the seed's first base.
+// When the seed starts the fragment that base must match anyway, but a
+// later seed's first base may be the one that differs. Such a seed is
+// also looked up exactly as each of its variants: the seed with its
+// first base replaced by every other symbol
+void firstBaseVariants(const string& seed, vector<string>& variants)
+{
+    // Assigned in place, so variants reused from search to search
+    // don't allocate again
+    variants.resize(DNAAlphabet::SIZE);
+    int n = 0;
+    for (int r = 0; r < DNAAlphabet::SIZE; r++)
+    {
+        if (r == DNAAlphabet::rank(seed[0]))
+            continue;
+        variants[n].assign(seed);
+        variants[n][0] = DNAAlphabet::symbol(r);
+        n++;
+    }
+    variants.resize(n);
+}
+
+// Each location in segment where the fragment's seed (the minSearchLength
+// bases starting at seedOffset) was found gives a place the fragment may
+// start. Extends the fragment from each such place as far as it matches,
+// and adds the longest match of at least minimumLength in each of the
+// segment's genomes to matches, in library order. If candidates is set,
+// only the genomes whose library index is set in it are considered
+bool GenomeMatcherImpl::collectMatches(const Search& search, const IndexSegment& segment, const string& fragment, int seedOffset, int minimumLength,
+                                       bool exactMatchOnly, const vector<Posting>& matchLocations, const vector<char>* candidates,
+                                       MatchScratch& scratch, vector<DNAMatchRef>& matches) const
+{
+    // No matches between fragment and any
+    // segment of any genome in the library
+    if (matchLocations.size() == 0)
+        return false;
+    
+    // scratch.best holds the best match so far in each genome. It only
+    // grows when the library does
+    vector<BestMatch>& best = scratch.best;
+    if (best.size() < search.library->numGenomes)
+        best.resize(search.library->numGenomes);
+    scratch.touched.clear();
+    
+    // For each match location...
+    bool stopped = false;
+    for (int i = 0; i < matchLocations.size(); i++)
+    {
+        if (search.stopped())
+        {
+            stopped = true;
+            break;
+        }
+        
+        int currentGenome;
+        long long currentPosition;
+        segment.locate(matchLocations[i], currentGenome, currentPosition);
+        currentPosition -= seedOffset;
+        
+        // The fragment would start before the beginning of the genome
+        if (currentPosition < 0)
+            continue;
+        
+        // The genome was ruled out before the search began
+        int libraryIndex = segment.firstGenome + currentGenome;
+        if (candidates != nullptr && !(*candidates)[libraryIndex])
+            continue;
+        
+        const Genome& genome = *segment.genomes[currentGenome];
+        
+        // actualLength is the length of the DNA piece that matches the fragment
+        int actualLength = matchLength(genome, currentPosition, fragment, exactMatchOnly, scratch.dna);
+        if (actualLength < minimumLength)
+            continue;
+        
+        // For each genome, we keep the piece with the best match.
+        // Equally long matches go to the earliest position, so the result does not
+        // depend on the order the index hands back its postings
+        BestMatch& b = best[libraryIndex];
+        if (b.length == 0)
+            scratch.touched.push_back(libraryIndex);
+        
+        if (b.length < actualLength || (b.length == actualLength && currentPosition < b.position))
+        {
+            b.length = actualLength;
+            b.position = currentPosition;
+        }
+    }
+    
+    // Transfer our collection of DNA matches to the matches vector,
+    // leaving scratch.best empty again for the next fragment
+    sort(scratch.touched.begin(), scratch.touched.end());
+    for (int i = 0; i < scratch.touched.size(); i++)
+    {
+        BestMatch& b = best[scratch.touched[i]];
+        if (!stopped)
+        {
+            DNAMatchRef d;
+            d.genomeName = &segment.names[scratch.touched[i] - segment.firstGenome];
+            d.length = b.length;
+            d.position = b.position;
+            matches.push_back(d);
+        }
+        b = BestMatch();
+    }
+    
+    return !stopped && !scratch.touched.empty();
+}
+
+// Returns the length of the longest prefix of fragment that matches the
+// genome's DNA starting at position, which is read into dna. Unless
+// exactMatchOnly, one base other than the first may differ
+int matchLength(const Genome& genome, long long position, const string& fragment, bool exactMatchOnly, string& dna)
+{
+    // Compare against no more DNA than the genome has left
+    int length = min<long long>(fragment.size(), genome.length() - position);
+    if (length <= 0 || !genome.extract(position, length, dna))
+        return 0;
+    
+    // snipped indicates if we have used up our one character mismatch
+    bool snipped = exactMatchOnly;
+    
+    for (int i = 0; i < length; i++)
+    {
+        if (dna[i] != fragment[i])
+        {
+            // Character mismatch!!! The first base must always match
+            if (snipped || i == 0)
+                return i;
+            
+            snipped = true;
+        }
+    }
+    
+    return length;
+}
+
+bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    if (fragmentMatchLength < minimumSearchLength())
+        return false;
+    
+    vector<vector<GenomeMatch>> allResults;
+    bool found = relatedGenomes(startSearch(), vector<const Genome*>(1, &query), fragmentMatchLength, exactMatchOnly, matchPercentThreshold, allResults);
+    results.swap(allResults[0]);
+    
+    return found;
+}
+
+bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold,
+                                           const RelatedGenomesOptions& options, vector<GenomeMatch>& results) const
+{
+    results.clear();
+    if (fragmentMatchLength < minimumSearchLength() || options.maxResults < 0 ||
+        !(options.confidence >= 0 && options.confidence < 1) || (options.slidingWindows && options.confidence > 0))
+        return false;
+    
+    if (options.slidingWindows)
+        return slidingRelatedGenomes(startSearch(), query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, options, results);
+    return sampleRelatedGenomes(startSearch(), query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, options, results);
+}
+
+bool GenomeMatcherImpl::findRelatedGenomes(const vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<vector<GenomeMatch>>& results) const
+{
+    vector<const Genome*> queryPtrs;
+    for (int q = 0; q < queries.size(); q++)
+        queryPtrs.push_back(&queries[q]);
+    
+    return relatedGenomes(startSearch(), queryPtrs, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+}
+
+// Every fragment is searched in the same version of the library, the one search started with
+bool GenomeMatcherImpl::relatedGenomes(const Search& search, const vector<const Genome*>& queries, int fragmentMatchLength, bool exactMatchOnly,
+                                       double matchPercentThreshold, vector<vector<GenomeMatch>>& results) const
+{
+    results.clear();
+    results.resize(queries.size());
+    
+    if (fragmentMatchLength < search.searchLength)
+        return false;
+    
+    // Maps a genome name to the number of times a sequence occurred in it,
+    // one map per query
+    vector<unordered_map<string, int>> genomeMatches(queries.size());
+    
+    // The fragments of every query are pooled into batches so that even
+    // short queries keep the batched lookup's window full. owners[j] is
+    // the query that fragments[j] came from
+    vector<string> fragments;
+    vector<int> owners;
+    
+    // candidates[q] marks the genomes query q may still turn out to be
+    // related to, or is empty if none were ruled out
+    vector<vector<char>> candidates(queries.size());
+    
+    for (int q = 0; q < queries.size(); q++)
+    {
+        vector<string> queryFragments;
+        if (!splitQuery(search, *queries[q], fragmentMatchLength, queryFragments))
+            return false;
+        
+        // Fragments that could only be found in genomes already ruled
+        // out can't change the results, so they aren't looked up
+        vector<char> useful;
+        bool filtered = prefilterGenomes(search, queryFragments, fragmentMatchLength, exactMatchOnly, matchPercentThreshold,
+                                         candidates[q], useful);
+        
+        for (int i = 0; i < queryFragments.size(); i++)
+        {
+            if (filtered && !useful[i])
+                continue;
+            
+            fragments.push_back(queryFragments[i]);
+            owners.push_back(q);
+            
+            // Batch is full, so run it before collecting more
+            if (fragments.size() == FRAGMENT_BATCH_SIZE)
+                countBatchMatches(search, fragments, owners, candidates, fragmentMatchLength, exactMatchOnly, genomeMatches);
+        }
+    }
+    
+    // Run whatever is left over after the last query
+    countBatchMatches(search, fragments, owners, candidates, fragmentMatchLength, exactMatchOnly, genomeMatches);
+    if (search.stopped())
+        return false;
+    
+    bool found = false;
+    for (int q = 0; q < queries.size(); q++)
+    {
+        long long numSequences = queries[q]->length() / fragmentMatchLength;
+        if (numSequences == 0)
+            continue;
+        
+        rankRelatedGenomes(*search.library, genomeMatches[q], numSequences, matchPercentThreshold, results[q]);
+        if (results[q].size() > 0)
+            found = true;
+    }
+    
+    return found;
+}
+
+// Splits query into the fragments findRelatedGenomes() looks up. Returns
+// false if the search was stopped
+bool GenomeMatcherImpl::splitQuery(const Search& search, const Genome& query, int fragmentMatchLength, vector<string>& fragments) const
+{
+    // numSequences is the number of sequences we will consider for analysis
+    long long numSequences = query.length() / fragmentMatchLength;
+    
+    fragments.clear();
+    for (long long i = 0; i < numSequences; i++)
+    {
+        if (search.stopped())
+            return false;
+        
+        string sequence = "error";
+        query.extract( (i * fragmentMatchLength), fragmentMatchLength, sequence);
+        
+        if (sequence == "error")
+            break;
+        
+        fragments.push_back(sequence);
+    }
+    
+    return true;
+}
+
+// findRelatedGenomes() for one query, returning at most options.maxResults
+// genomes and, if options.confidence is set, stopping early.
+//
+// To stop early the fragments are looked up in a random order, so the
+// fragments looked up so far are a random sample of the query. After
+// each batch, the fraction of the sample found in a genome bounds the
+// fraction of all the fragments that will be, by Hoeffding's inequality
+// as tightened by Serfling for sampling without replacement. The bounds
+// are also clipped to what the fragments left could still change. They
+// are made to hold for every genome at every check at once, so the
+// search stops only when, with the confidence asked for, the genomes
+// over the threshold (or the best maxResults of them) are known
+bool GenomeMatcherImpl::sampleRelatedGenomes(const Search& search, const Genome& query, int fragmentMatchLength, bool exactMatchOnly,
+                                             double matchPercentThreshold, const RelatedGenomesOptions& options,
+                                             vector<GenomeMatch>& results) const
+{
+    results.clear();
+    if (fragmentMatchLength < search.searchLength)
+        return false;
+    
+    vector<string> fragments;
+    if (!splitQuery(search, query, fragmentMatchLength, fragments))
+        return false;
+    long long numSequences = query.length() / fragmentMatchLength;
+    if (numSequences == 0)
+        return false;
+    
+    // Fragments the filters show can't be found in any genome that
+    // might reach the threshold are known to add nothing, so only the
+    // useful ones are sampled
+    const LibraryVersion& library = *search.library;
+    vector<vector<char>> candidates(1);
+    vector<char> useful;
+    bool filtered = prefilterGenomes(search, fragments, fragmentMatchLength, exactMatchOnly, matchPercentThreshold,
+                                     candidates[0], useful);
+    
+    vector<int> order;
+    for (int i = 0; i < fragments.size(); i++)
+    {
+        if (!filtered || useful[i])
+            order.push_back(i);
+    }
+    if (options.confidence > 0)
+        shuffle(order.begin(), order.end(), mt19937(options.randomSeed));
+    int numSampled = order.size();
+    
+    // The bounds must hold at every check, so the chance of error allowed
+    // is split over all the checks the search could make
+    int maxChecks = 0;
+    for (int done = 0, size = FIRST_SAMPLE_BATCH_SIZE; done < numSampled; size = min(2 * size, FRAGMENT_BATCH_SIZE))
+    {
+        done += size;
+        maxChecks++;
+    }
+    double logTerm = log(2.0 * max(1, library.numGenomes) * max(1, maxChecks) / (1 - options.confidence));
+    
+    vector<unordered_map<string, int>> genomeMatches(1);
+    vector<string> batch;
+    vector<int> owners;
+    int examined = 0;
+    bool settled = false;
+    vector<double> estimate(library.numGenomes), lower(library.numGenomes), upper(library.numGenomes);
+    vector<int> best;       // library indexes of the genomes to return once settled
+    
+    for (int size = FIRST_SAMPLE_BATCH_SIZE; examined < numSampled && !settled; size = min(2 * size, FRAGMENT_BATCH_SIZE))
+    {
+        for (int j = 0; j < size && examined < numSampled; j++)
+        {
+            batch.push_back(fragments[order[examined++]]);
+            owners.push_back(0);
+        }
+        countBatchMatches(search, batch, owners, candidates, fragmentMatchLength, exactMatchOnly, genomeMatches);
+        if (search.stopped())
+            return false;
+        if (options.confidence == 0 || examined == numSampled)
+            continue;
+        
+        // Bounds, as percentages of all numSequences fragments, on how
+        // many fragments each genome will turn out to match
+        double epsilon = sqrt((1 - (examined - 1) / static_cast<double>(numSampled)) * logTerm / (2 * examined));
+        int remaining = numSampled - examined;
+        vector<int> open;       // genomes that may still reach the threshold
+        for (int i = 0; i < library.numGenomes; i++)
+        {
+            if (filtered && !candidates[0][i])
+            {
+                upper[i] = 0;
+                continue;
+            }
+            
+            int count = genomeMatches[0][library.genome(i).name()];
+            double rate = count / static_cast<double>(examined);
+            estimate[i] = rate * numSampled / numSequences * 100;
+            lower[i] = max<double>(count, (rate - epsilon) * numSampled) / numSequences * 100;
+            upper[i] = min<double>(count + remaining, (rate + epsilon) * numSampled) / numSequences * 100;
+            if (upper[i] > matchPercentThreshold)
+                open.push_back(i);
+        }
+        
+        // The best genomes by estimate, all of them unless maxResults is set
+        best = open;
+        sort(best.begin(), best.end(), [&](int a, int b) { return estimate[a] > estimate[b]; });
+        if (options.maxResults > 0 && best.size() > options.maxResults)
+            best.resize(options.maxResults);
+        
+        // Settled if the best are certain to reach the threshold, and
+        // certain to beat every other genome that might
+        settled = true;
+        double weakest = 100;
+        for (int k = 0; k < best.size(); k++)
+        {
+            if (lower[best[k]] <= matchPercentThreshold)
+                settled = false;
+            weakest = min(weakest, lower[best[k]]);
+        }
+        for (int k = best.size(); k < open.size() && settled; k++)
+        {
+            if (upper[open[k]] >= weakest)
+                settled = false;
+        }
+    }
+    
+    if (settled)
+    {
+        // The percentages are estimates from the fragments looked up
+        for (int k = 0; k < best.size(); k++)
+        {
+            GenomeMatch g;
+            g.genomeName = library.genome(best[k]).name();
+            g.percentMatch = estimate[best[k]];
+            results.push_back(g);
+        }
+        sort(results.begin(), results.end(), &genomeMatchCompare);
+    }
+    else
+    {
+        rankRelatedGenomes(library, genomeMatches[0], numSequences, matchPercentThreshold, results);
+        if (options.maxResults > 0 && results.size() > options.maxResults)
+            results.resize(options.maxResults);
+    }
+    
+    return results.size() > 0;
+}
+
+// findRelatedGenomes() over every window of the query.
+//
+// Not every seed of the query needs looking up. Every window that
+// matches a genome holds a run of seeds that all lead to the same
+// diagonal, a fixed shift between query and genome positions. So seeds
+// are sampled at a stride that leaves at least one in every window, or
+// two when a mismatch is allowed, since one of them may start at the
+// mismatch.
+//
+// Every window holding a sampled seed is then checked along each
+// diagonal the seed leads to. The windows overlap, so the bases they
+// cover are compared once and the differences counted as the window
+// slides, rather than each window being extended on its own
+bool GenomeMatcherImpl::slidingRelatedGenomes(const Search& search, const Genome& query, int fragmentMatchLength, bool exactMatchOnly,
+                                              double matchPercentThreshold, const RelatedGenomesOptions& options,
+                                              vector<GenomeMatch>& results) const
+{
+    results.clear();
+    if (fragmentMatchLength < search.searchLength)
+        return false;
+    
+    long long numWindows = query.length() - fragmentMatchLength + 1;
+    string bases;
+    if (numWindows <= 0 || !query.extract(0, query.length(), bases))
+        return false;
+    
+    int seedsPerWindow = fragmentMatchLength - search.searchLength + 1;
+    int stride = exactMatchOnly ? seedsPerWindow : max(1, seedsPerWindow / 2);
+    
+    const LibraryVersion& library = *search.library;
+    vector<int> windowsFound(library.numGenomes, 0);
+    for (int s = 0; s < library.segments.size(); s++)
+    {
+        const IndexSegment& segment = *library.segments[s];
+        SeedBatch batch;
+        vector<pair<long long, int>> found;
+        visitSeedBatches(search, segment, bases, stride, exactMatchOnly, true, batch, [&](bool lastBatch)
+        {
+            scoreWindows(search, segment, bases, fragmentMatchLength, exactMatchOnly, lastBatch, batch, found, windowsFound);
+        });
+        if (search.stopped())
+            return false;
+    }
+    
+    unordered_map<string, int> genomeMatches;
+    for (int i = 0; i < library.numGenomes; i++)
+    {
+        if (windowsFound[i] > 0)
+            genomeMatches[library.genome(i).name()] = windowsFound[i];
+    }
+    rankRelatedGenomes(library, genomeMatches, numWindows, matchPercentThreshold, results);
+    if (options.maxResults > 0 && results.size() > options.maxResults)
+        results.resize(options.maxResults);
+    
+    return results.size() > 0;
+}
+
+// Samples the seeds of a query, whose bases are in bases, at least one
+// in every stride seeds, and looks them up in segment a batch at a time.
+// Seeds containing N are sampled only if ambiguousSeeds, and then only
+// if the index holds them. visit(lastBatch) is called with each batch
+// looked up, and must leave it empty. Each batch looks up each distinct
+// seed once, all together so the index walks overlap
+template<typename Visitor>
+void GenomeMatcherImpl::visitSeedBatches(const Search& search, const IndexSegment& segment, const string& bases, int stride,
+                                         bool exactMatchOnly, bool ambiguousSeeds, SeedBatch& batch, Visitor visit) const
+{
+    int seedLength = search.searchLength;
+    auto lookUp = [&](bool lastBatch)
+    {
+        if (search.stopped())
+            return;
+        
+        // Seeds sampled more than once share one lookup
+        int numSeeds = batch.starts.size();
+        auto compareSeeds = [&](int a, int b)
+        {
+            return bases.compare(batch.starts[a], seedLength, bases, batch.starts[b], seedLength);
+        };
+        batch.bySeed.resize(numSeeds);
+        for (int j = 0; j < numSeeds; j++)
+            batch.bySeed[j] = j;
+        sort(batch.bySeed.begin(), batch.bySeed.end(), [&](int a, int b) { return compareSeeds(a, b) < 0; });
+        
+        batch.seeds.clear();
+        batch.seedOf.resize(numSeeds);
+        for (int j = 0; j < numSeeds; j++)
+        {
+            int w = batch.bySeed[j];
+            if (j > 0 && compareSeeds(w, batch.bySeed[j - 1]) == 0)
+            {
+                batch.seedOf[w] = batch.seedOf[batch.bySeed[j - 1]];
+                continue;
+            }
+            batch.seedOf[w] = batch.seeds.size();
+            batch.seeds.push_back(bases.substr(batch.starts[w], seedLength));
+        }
+        segment.findBatch(batch.seeds, exactMatchOnly, batch.postings, seedLength < m_indexLength);
+        visit(lastBatch);
+    };
+    
+    string seed;
+    auto usable = [&](long long position)
+    {
+        seed.assign(bases, position, seedLength);
+        if (!ambiguousSeeds && seed.find('N') != string::npos)
+            return false;
+        return usableSeed(search, seed);
+    };
+    
+    long long lastSampled = -1;
+    auto sample = [&](long long position)
+    {
+        batch.starts.push_back(position);
+        lastSampled = position;
+        if (batch.starts.size() == FRAGMENT_BATCH_SIZE)
+            lookUp(false);
+    };
+    
+    // Seeds are sampled at every multiple of stride. Where that seed
+    // can't be looked up, every seed within stride of it either way that
+    // can is sampled instead, so that a window holding any seed that can
+    // be looked up still holds a sampled one
+    long long numSeeds = static_cast<long long>(bases.size()) - seedLength + 1;
+    for (long long m = 0; m < numSeeds && !search.stopped(); m += stride)
+    {
+        if (usable(m))
+        {
+            if (m > lastSampled)
+                sample(m);
+            continue;
+        }
+        
+        for (long long position = max(lastSampled + 1, m - stride + 1); position < min(m + stride, numSeeds); position++)
+        {
+            if (usable(position))
+                sample(position);
+        }
+    }
+    lookUp(true);
+}
 
-GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength)
-: m_minSearchLength(minSearchLength)
-{}
+// Checks the windows holding each seed in batch along every diagonal of
+// segment it leads to, then empties the batch. A window is found in a
+// genome where it matches fragmentMatchLength bases of it, with one base
+// other than the first allowed to differ unless exactMatchOnly. found
+// holds windows (with the library index of the genome) that later seeds
+// may find again. The rest are added to windowsFound, each once per
+// genome however many diagonals found it
+void GenomeMatcherImpl::scoreWindows(const Search& search, const IndexSegment& segment, const string& query, int fragmentMatchLength,
+                                     bool exactMatchOnly, bool lastBatch, SeedBatch& batch, vector<pair<long long, int>>& found,
+                                     vector<int>& windowsFound) const
+{
+    int numSeeds = batch.starts.size();
+    long long numWindows = query.size() - fragmentMatchLength + 1;
+    int reach = fragmentMatchLength - search.searchLength;     // how far back of a seed its windows start
+    
+    for (int w = 0; w < numSeeds; w++)
+    {
+        if (search.stopped())
+            return;
+        
+        long long seedStart = batch.starts[w];
+        const vector<Posting>& postings = batch.postings[batch.seedOf[w]];
+        for (int p = 0; p < postings.size(); p++)
+        {
+            int currentGenome;
+            long long currentPosition;
+            segment.locate(postings[p], currentGenome, currentPosition);
+            int libraryIndex = segment.firstGenome + currentGenome;
+            const Genome& genome = *segment.genomes[currentGenome];
+            
+            // The windows holding the seed that lie wholly in the query and the genome
+            long long shift = currentPosition - seedStart;
+            long long first = max(max(seedStart - reach, -shift), 0LL);
+            long long last = min(min(seedStart, numWindows - 1), genome.length() - fragmentMatchLength - shift);
+            if (first > last)
+                continue;
+            
+            // Slide the window along, counting the differences in it
+            int span = last + fragmentMatchLength - first;
+            if (!genome.extract(first + shift, span, batch.dna))
+                continue;
+            
+            int differences = 0;
+            for (int k = 0; k < fragmentMatchLength; k++)
+                differences += batch.dna[k] != query[first + k];
+            for (int k = 0; first + k <= last; k++)
+            {
+                bool differsAtStart = batch.dna[k] != query[first + k];
+                if (exactMatchOnly ? differences == 0 : differences <= 1 && !differsAtStart)
+                    found.push_back(make_pair(first + k, libraryIndex));
+                
+                differences -= differsAtStart;
+                if (k + fragmentMatchLength < span)
+                    differences += batch.dna[k + fragmentMatchLength] != query[first + k + fragmentMatchLength];
+            }
+        }
+    }
+    
+    // Later seeds start after this batch's last, so they can't reach
+    // windows before done
+    long long done = lastBatch || numSeeds == 0 ? numWindows : batch.starts.back() + 1 - reach;
+    sort(found.begin(), found.end());
+    int kept = 0;
+    for (int j = 0; j < found.size(); j++)
+    {
+        if (j > 0 && found[j] == found[j - 1])
+            continue;
+        if (found[j].first < done)
+            windowsFound[found[j].second]++;
+        else
+            found[kept++] = found[j];
+    }
+    found.resize(kept);
+    
+    batch.starts.clear();
+}
 
-void GenomeMatcherImpl::addGenome(const Genome& genome)
+// Maximal exact matches are found by seed and extend. Every match of at
+// least minimumLength bases holds a run of seeds that all lead to its
+// diagonal, so seeds are sampled at a stride that leaves one in every
+// such match, and each occurrence of a seed is extended both ways as far
+// as query and genome agree. Only the first seed of a match to reach it
+// extends it: where the last match on each diagonal ends is kept, and
+// later seeds before that end are skipped, so a long match is compared
+// base by base once
+bool GenomeMatcherImpl::findMaximalMatches(const Genome& query, int minimumLength, vector<MaximalMatch>& matches) const
 {
-    m_genomeLibrary.push_back(genome);
+    matches.clear();
+    Search search = startSearch();
+    if (minimumLength < search.searchLength || query.length() < minimumLength)
+        return false;
+    
+    string bases;
+    if (!query.extract(0, query.length(), bases))
+        return false;
+    
+    int stride = minimumLength - search.searchLength + 1;
+    const LibraryVersion& library = *search.library;
+    vector<SegmentMatch> found;
+    for (int s = 0; s < library.segments.size(); s++)
+    {
+        const IndexSegment& segment = *library.segments[s];
+        SeedBatch batch;
+        unordered_map<long long, long long> matchEnds;
+        visitSeedBatches(search, segment, bases, stride, true, false, batch, [&](bool)
+        {
+            extendMaximalMatches(search, segment, bases, minimumLength, batch, matchEnds, found);
+        });
+    }
+    
+    sort(found.begin(), found.end(), [](const SegmentMatch& a, const SegmentMatch& b)
+    {
+        if (a.queryPosition != b.queryPosition)
+            return a.queryPosition < b.queryPosition;
+        if (a.genome != b.genome)
+            return a.genome < b.genome;
+        return a.genomePosition < b.genomePosition;
+    });
+    
+    for (int i = 0; i < found.size(); i++)
+    {
+        MaximalMatch m;
+        m.genomeName = library.genome(found[i].genome).name();
+        m.queryPosition = found[i].queryPosition;
+        m.genomePosition = found[i].genomePosition;
+        m.length = found[i].length;
+        matches.push_back(m);
+    }
+    
+    return matches.size() > 0;
+}
 
-    // We sequence the genome's DNA by the minimum search length
-    // and stop when there is no more of the minSearchLength bases
-    // left to extract
-    for (int i = 0; ; i++)
+// How many bases query and genome agree for from query position q and
+// genome position g, going forward, or going back from just before them.
+// N agrees with nothing
+long long extendExactMatch(const string& query, long long q, const Genome& genome, long long g, bool forward, string& dna)
+{
+    long long limit = forward ? min<long long>(query.size() - q, genome.length() - g) : min(q, g);
+    long long length = 0;
+    while (length < limit)
     {
-        string substring = "error";
-        genome.extract(i, m_minSearchLength, substring);
-        
-        if (substring == "error")
+        int chunk = min<long long>(EXTEND_CHUNK_BASES, limit - length);
+        if (!genome.extract(forward ? g + length : g - length - chunk, chunk, dna))
             break;
         
-        // substring was successfully set, so we create a value for that sequence
-        // representing the genome in which, and position at, the sequence was found.
-        // We start counting at genome 1, 2, 3 and so forth
-        pair<int, int> genomeANDposition(m_genomeLibrary.size(), i);
-        
-        // Insert the search key seqeunce and pair into our Trie
-        m_sequencedDNA.insert(substring, genomeANDposition);
+        // Going back, the chunk is read from its end
+        for (int k = 0; k < chunk; k++)
+        {
+            char base = forward ? dna[k] : dna[chunk - 1 - k];
+            if (base != query[forward ? q + length + k : q - length - k - 1] || base == 'N')
+                return length + k;
+        }
+        length += chunk;
     }
+    return length;
 }
 
-int GenomeMatcherImpl::minimumSearchLength() const
+// Extends each occurrence in segment of each seed in batch into the
+// maximal exact match holding it, adding those of at least minimumLength
+// bases to matches, then empties the batch. matchEnds maps a diagonal,
+// as a posting offset less the query position of its seed, to the query
+// position where the last match found on it ends
+void GenomeMatcherImpl::extendMaximalMatches(const Search& search, const IndexSegment& segment, const string& query, int minimumLength,
+                                             SeedBatch& batch, unordered_map<long long, long long>& matchEnds,
+                                             vector<SegmentMatch>& matches) const
 {
-    return m_minSearchLength;
+    for (int w = 0; w < batch.starts.size(); w++)
+    {
+        if (search.stopped())
+            return;
+        
+        long long seedStart = batch.starts[w];
+        const vector<Posting>& postings = batch.postings[batch.seedOf[w]];
+        for (int p = 0; p < postings.size(); p++)
+        {
+            // An earlier seed already found the match holding this one
+            long long diagonal = postings[p].offset() - seedStart;
+            unordered_map<long long, long long>::iterator it = matchEnds.find(diagonal);
+            if (it != matchEnds.end() && seedStart < it->second)
+                continue;
+            
+            int currentGenome;
+            long long currentPosition;
+            segment.locate(postings[p], currentGenome, currentPosition);
+            const Genome& genome = *segment.genomes[currentGenome];
+            
+            long long before = extendExactMatch(query, seedStart, genome, currentPosition, false, batch.dna);
+            long long after = extendExactMatch(query, seedStart + search.searchLength, genome,
+                                               currentPosition + search.searchLength, true, batch.dna);
+            long long length = before + search.searchLength + after;
+            if (length < minimumLength)
+                continue;
+            
+            SegmentMatch m;
+            m.genome = segment.firstGenome + currentGenome;
+            m.queryPosition = seedStart - before;
+            m.genomePosition = currentPosition - before;
+            m.length = length;
+            matches.push_back(m);
+            matchEnds[diagonal] = m.queryPosition + length;
+        }
+    }
+    
+    // Later seeds start after this batch's last, so can't be in the
+    // matches that end before it
+    long long next = batch.starts.empty() ? 0 : batch.starts.back() + 1;
+    for (unordered_map<long long, long long>::iterator it = matchEnds.begin(); it != matchEnds.end(); )
+    {
+        if (it->second < next)
+            it = matchEnds.erase(it);
+        else
+            it++;
+    }
+    
+    batch.starts.clear();
 }
 
-bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+// The fragments of every genome in the library, laid end to end, are
+// cut into tiles of FRAGMENT_BATCH_SIZE, so that a long genome is shared
+// out over several threads and short ones still fill the batched
+// lookup. Each fragment is looked up once and its matches counted
+// against every genome it is found in. Tiles are handed out in library
+// order, and whichever thread finishes the last tile of a row writes it,
+// along with any finished rows after it, once the rows before it are
+// written
+bool GenomeMatcherImpl::computeSimilarityMatrix(int fragmentMatchLength, bool exactMatchOnly, ostream& output) const
 {
-    if (fragment.size() < minimumLength)
+    // Cancelled if writing fails, so the other threads stop
+    QueryOptions limits;
+    Search search = startSearch(limits);
+    if (fragmentMatchLength < search.searchLength || !output)
         return false;
     
-    if (minimumLength < m_minSearchLength)
-        return false;
+    // Matches are counted by genome name, just as rankRelatedGenomes()
+    // counts them, so column[name] is the first genome with that name.
+    // Genome i's fragments are numbered from firstFragments[i]
+    const LibraryVersion& library = *search.library;
+    int numGenomes = library.numGenomes;
+    vector<string> names;
+    unordered_map<string, int> column;
+    vector<long long> firstFragments(1, 0);
+    for (int i = 0; i < numGenomes; i++)
+    {
+        names.push_back(library.genome(i).name());
+        column.insert(make_pair(names[i], i));
+        firstFragments.push_back(firstFragments[i] + library.genome(i).length() / fragmentMatchLength);
+    }
+    long long numTiles = (firstFragments[numGenomes] + FRAGMENT_BATCH_SIZE - 1) / FRAGMENT_BATCH_SIZE;
     
-    matches.clear();
+    output << "genome";
+    for (int j = 0; j < numGenomes; j++)
+        output << '\t' << names[j];
+    output << '\n';
+    
+    // rows[i] holds the counts of a row being worked on, and tilesLeft[i]
+    // the tiles with fragments of it not yet counted. Rows are freed once
+    // written
+    mutex rowMutex;
+    vector<vector<int>> rows(numGenomes);
+    vector<int> tilesLeft(numGenomes, 0);
+    for (int i = 0; i < numGenomes; i++)
+    {
+        if (firstFragments[i + 1] > firstFragments[i])
+            tilesLeft[i] = (firstFragments[i + 1] - 1) / FRAGMENT_BATCH_SIZE - firstFragments[i] / FRAGMENT_BATCH_SIZE + 1;
+    }
+    int nextRow = 0;
+    
+    // Write every finished row that is next in line. rowMutex must be held
+    auto writeRows = [&]()
+    {
+        for (; nextRow < numGenomes && tilesLeft[nextRow] == 0; nextRow++)
+        {
+            long long numSequences = firstFragments[nextRow + 1] - firstFragments[nextRow];
+            output << names[nextRow];
+            for (int j = 0; j < numGenomes; j++)
+            {
+                int count = rows[nextRow].empty() ? 0 : rows[nextRow][column.at(names[j])];
+                output << '\t' << (numSequences == 0 ? 0 : ( count / static_cast<double>(numSequences) ) * 100);
+            }
+            output << '\n';
+            vector<int>().swap(rows[nextRow]);
+        }
+        if (!output)
+            limits.cancellation.cancel();
+    };
     
-    string fragSearchKey = fragment.substr(0, m_minSearchLength);
+    atomic<long long> nextTile(0);
+    auto work = [&]()
+    {
+        Search tileSearch = search;
+        vector<string> fragments;
+        vector<int> owners;
+        vector<vector<DNAMatch>> matches;
+        for (long long t = nextTile++; t < numTiles && !tileSearch.stopped(); t = nextTile++)
+        {
+            long long first = t * FRAGMENT_BATCH_SIZE;
+            long long last = min<long long>(first + FRAGMENT_BATCH_SIZE, firstFragments[numGenomes]);
+            int query = upper_bound(firstFragments.begin(), firstFragments.end(), first) - firstFragments.begin() - 1;
+            fragments.resize(last - first);
+            owners.resize(last - first);
+            for (long long f = first; f < last; f++)
+            {
+                while (f >= firstFragments[query + 1])
+                    query++;
+                owners[f - first] = query;
+                library.genome(query).extract((f - firstFragments[query]) * fragmentMatchLength, fragmentMatchLength, fragments[f - first]);
+            }
+            
+            findGenomesWithThisDNA(tileSearch, fragments, fragmentMatchLength, exactMatchOnly, matches);
+            if (tileSearch.stopped())
+                break;
+            
+            lock_guard<mutex> lock(rowMutex);
+            for (int f = 0; f < matches.size(); f++)
+            {
+                vector<int>& row = rows[owners[f]];
+                if (row.empty())
+                    row.assign(numGenomes, 0);
+                for (int m = 0; m < matches[f].size(); m++)
+                    row[column.at(matches[f][m].genomeName)]++;
+                
+                // The tile's last fragment of this row
+                if (f + 1 == matches.size() || owners[f + 1] != owners[f])
+                    tilesLeft[owners[f]]--;
+            }
+            writeRows();
+        }
+    };
     
-    // matchLocations has the genome # and positions of each spot
-    // that the minSearchLength (as stored by the GenomeMatcher
-    // object) amount of the fragment was found
+    // The executor's threads and this one share the tiles
+    int numHelpers = max<int>(1, thread::hardware_concurrency()) - 1;
+    vector<future<void>> helpers;
+    for (int h = 0; h < numHelpers; h++)
+    {
+        auto task = make_shared<packaged_task<void()>>(work);
+        helpers.push_back(task->get_future());
+        m_executor.submit([task]() { (*task)(); });
+    }
+    work();
+    for (int h = 0; h < helpers.size(); h++)
+        helpers[h].wait();
     
-    // each pair holds the genome number (indexed by the library), and position
-    vector<pair<int,int>> matchLocations = m_sequencedDNA.find(fragSearchKey, exactMatchOnly);
+    // Genomes too short for a fragment may be left after the last tile
+    if (!search.stopped())
+        writeRows();
     
-    // No matches between fragment and any
-    // segment of any genome in the library
-    if (matchLocations.size() == 0)
+    output.flush();
+    return nextRow == numGenomes && output;
+}
+
+// Rules out, for one query, the genomes whose filters show that too few
+// of the query's fragments could be found in them to reach the threshold.
+// Sets candidates[i] for every library genome i not ruled out, and
+// useful[f] for every fragment that could be found in one of them.
+// Returns false, setting neither, if the library can't be filtered for
+// this search
+bool GenomeMatcherImpl::prefilterGenomes(const Search& search, const vector<string>& fragments, int fragmentMatchLength, bool exactMatchOnly,
+                                         double matchPercentThreshold, vector<char>& candidates, vector<char>& useful) const
+{
+    // The filters hold seeds of m_filterLength bases, so they can't
+    // answer for the shorter seeds of a shorter search
+    if (m_options.filterBitsPerSeed <= 0 || search.searchLength < m_filterLength || fragments.empty())
         return false;
     
-    // Declare unordered_map that will store the best DNA
-    // match for each genome
-    unordered_map<int, DNAMatch> match;
+    const LibraryVersion& library = *search.library;
+    int numSequences = fragments.size();
     
-    // For each match location...
-    for (int i = 0; i < matchLocations.size(); i++)
+    // What each fragment's seed must be in a genome the fragment is found
+    // in: the seed itself, or if a mismatch is allowed, the seed with any
+    // one base replaced but the fragment's first. A fragment with no
+    // usable seed is found nowhere, and gets no probes
+    vector<vector<uint64_t>> probes(numSequences);
+    for (int f = 0; f < numSequences; f++)
     {
-        // snipped indicates if we should allow a character mismatch when building up
-        // the piece of DNA
-        bool snipped = exactMatchOnly;
+        if (search.stopped())
+            return false;
         
-        int currentGenome = matchLocations[i].first;
-        int currentPosition = matchLocations[i].second;
+        string seed;
+        int offset = seedOffset(search, fragments[f], fragmentMatchLength, seed);
+        if (offset < 0)
+            continue;
+        
+        seed.resize(m_filterLength);
+        probes[f].push_back(BloomFilter::hash(seed.data(), m_filterLength));
         
-        int actualLength = m_minSearchLength;
+        if (exactMatchOnly)
+            continue;
         
-        // Start with the piece of DNA with length minSearchLength, stored in the
-        // matchLocations vector. We will now build up the piece, base by base,
-        // checking it against the fragment and seeing if it is valid.
-        for ( ; actualLength <= fragment.size(); actualLength++)
+        string variant = seed;
+        for (int d = offset > 0 ? 0 : 1; d < m_filterLength; d++)
         {
-            string substring = "error";
-            m_genomeLibrary[currentGenome - 1].extract(currentPosition, actualLength, substring);
-            // The currentGenome - 1 correction is because we started counting at
-            // genome 1, 2, 3, and so forth when we added genomes.
-            
-            if (substring == "error")
-                break;
-            
-            // substring is set to the DNA piece, with an extra base
-            if (substring == fragment.substr(0, actualLength))
+            for (int r = 0; r < DNAAlphabet::SIZE; r++)
             {
-                if (actualLength == fragment.size())
-                    break;
-                else
+                if (r == DNAAlphabet::rank(seed[d]))
                     continue;
+                variant[d] = DNAAlphabet::symbol(r);
+                probes[f].push_back(BloomFilter::hash(variant.data(), m_filterLength));
             }
-            else
+            variant[d] = seed[d];
+        }
+    }
+    
+    // Count, for each genome, the fragments its filter might hold, stopping
+    // as soon as the count is certain to clear the threshold or to miss it.
+    // The percentage is worked out just as rankRelatedGenomes() does
+    candidates.assign(library.numGenomes, 0);
+    for (int s = 0; s < library.segments.size(); s++)
+    {
+        const IndexSegment& segment = *library.segments[s];
+        for (int g = 0; g < segment.filters.size(); g++)
+        {
+            if (search.stopped())
+                return false;
+            
+            const BloomFilter& filter = *segment.filters[g];
+            int found = 0;
+            for (int f = 0; f < numSequences; f++)
             {
-                // If we permit one character mismatch
-                if (!snipped)
-                {
-                    if (substring.size() == fragment.size())
-                        break;
-                    
-                    snipped = true;
-                    continue;
-                }
-                else        // No more character mismatches allowed
+                if ((found / static_cast<double>(numSequences)) * 100 > matchPercentThreshold ||
+                    ((found + numSequences - f) / static_cast<double>(numSequences)) * 100 <= matchPercentThreshold)
+                    break;
+                
+                for (int p = 0; p < probes[f].size(); p++)
                 {
-                    if (substring[actualLength - 1] != fragment.at(actualLength - 1))   // Character mismatch!!!
+                    if (filter.mayContain(probes[f][p]))
                     {
-                        actualLength--;
+                        found++;
                         break;
                     }
-                    
-                    if (substring.size() == fragment.size())
-                        break;
                 }
             }
+            
+            if ((found / static_cast<double>(numSequences)) * 100 > matchPercentThreshold)
+                candidates[segment.firstGenome + g] = 1;
         }
-
-        // actualLength is the length of the DNA piece that matches the fragment
-        if (actualLength < minimumLength)
-            continue;
-        
-        DNAMatch d;
-        d.genomeName = m_genomeLibrary[currentGenome - 1].name();
-        d.length = actualLength;
-        d.position = currentPosition;
-        
+    }
     
-        // For each genome, we will store the piece with the best match in the match map.
-        unordered_map<int, DNAMatch>::iterator it = match.find(currentGenome);
-        
-        if (it != match.end())
+    useful.assign(numSequences, 0);
+    for (int s = 0; s < library.segments.size(); s++)
+    {
+        const IndexSegment& segment = *library.segments[s];
+        for (int g = 0; g < segment.filters.size(); g++)
         {
-            if (match[currentGenome].length < d.length)
+            if (!candidates[segment.firstGenome + g])
+                continue;
+            
+            const BloomFilter& filter = *segment.filters[g];
+            for (int f = 0; f < numSequences; f++)
             {
-                match[currentGenome] = d;
+                for (int p = 0; p < probes[f].size() && !useful[f]; p++)
+                {
+                    if (filter.mayContain(probes[f][p]))
+                        useful[f] = 1;
+                }
             }
         }
-        else
-            match.insert(make_pair(currentGenome, d));
-    }
-    
-    // Transfer our collection of DNA matches to the matches vector
-    unordered_map<int, DNAMatch>::iterator it = match.begin();
-    for (; it != match.end(); it++)
-    {
-        matches.push_back( (it->second) );
     }
     
-    if (matches.size() == 0)
-        return false;
-    
     return true;
 }
 
-bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+future<DNASearchResult> GenomeMatcherImpl::findGenomesWithThisDNAAsync(const string& fragment, int minimumLength, bool exactMatchOnly,
+                                                                       const QueryOptions& options) const
 {
-    if (fragmentMatchLength < m_minSearchLength)
-        return false;
-    
-    results.clear();
-    unordered_map<string, int> genomeMatches;       // Maps a genome name to the number of times a sequence occurred in it
-    
-    // numSequences is the number of sequences we will consider for analysis
-    int numSequences = query.length() / fragmentMatchLength;
+    // The task owns copies of its arguments, since the caller's may be
+    // gone by the time it runs
+    auto task = make_shared<packaged_task<DNASearchResult()>>([this, fragment, minimumLength, exactMatchOnly, options]()
+    {
+        DNASearchResult result;
+        Search search = startSearch(options);
+        
+        vector<vector<DNAMatch>> allMatches;
+        result.found = !search.stopped() && fragment.size() >= minimumLength &&
+                       findGenomesWithThisDNA(search, vector<string>(1, fragment), minimumLength, exactMatchOnly, allMatches);
+        
+        result.status = search.outcome;
+        if (result.status == QueryStatus::Completed && !allMatches.empty())
+            result.matches.swap(allMatches[0]);
+        else
+            result.found = false;
+        return result;
+    });
     
-    if (numSequences == 0)
-        return false;
+    future<DNASearchResult> result = task->get_future();
+    m_executor.submit([task]() { (*task)(); });
+    return result;
+}
 
-    // Loop through each sequence of DNA
-    for (int i = 0; i < numSequences; i++)
+future<RelatedGenomesResult> GenomeMatcherImpl::findRelatedGenomesAsync(const Genome& query, int fragmentMatchLength, bool exactMatchOnly,
+                                                                        double matchPercentThreshold, const QueryOptions& options) const
+{
+    auto task = make_shared<packaged_task<RelatedGenomesResult()>>([this, query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, options]()
     {
-        string sequence = "error";
-        query.extract( (i * fragmentMatchLength), fragmentMatchLength, sequence);
-
-        if (sequence == "error")
-            break;
+        RelatedGenomesResult result;
+        Search search = startSearch(options);
         
-        vector<DNAMatch> matches;
-        findGenomesWithThisDNA(sequence, fragmentMatchLength, exactMatchOnly, matches);
+        vector<vector<GenomeMatch>> allResults;
+        result.found = !search.stopped() &&
+                       relatedGenomes(search, vector<const Genome*>(1, &query), fragmentMatchLength, exactMatchOnly, matchPercentThreshold, allResults);
         
-        // For each sequence of DNA, map the number of times it was found
-        // in each Genome
-        for (int i = 0; i < matches.size(); i++)
-        {
-            genomeMatches[matches[i].genomeName]++;
-        }
+        result.status = search.outcome;
+        if (result.status == QueryStatus::Completed && !allResults.empty())
+            result.results.swap(allResults[0]);
+        else
+            result.found = false;
+        return result;
+    });
+    
+    future<RelatedGenomesResult> result = task->get_future();
+    m_executor.submit([task]() { (*task)(); });
+    return result;
+}
+
+// Looks up one batch of query fragments, adds one to the owning query's
+// count for every genome each fragment was found in, then empties the batch
+void GenomeMatcherImpl::countBatchMatches(const Search& search, vector<string>& fragments, vector<int>& owners,
+                                          const vector<vector<char>>& candidates, int fragmentMatchLength,
+                                          bool exactMatchOnly, vector<unordered_map<string, int>>& genomeMatches) const
+{
+    vector<const vector<char>*> fragmentCandidates;
+    for (int j = 0; j < fragments.size(); j++)
+        fragmentCandidates.push_back(candidates[owners[j]].empty() ? nullptr : &candidates[owners[j]]);
+    
+    vector<vector<DNAMatch>> matches;
+    findGenomesWithThisDNA(search, fragments, fragmentMatchLength, exactMatchOnly, matches, fragmentCandidates);
+    
+    for (int j = 0; j < matches.size(); j++)
+    {
+        for (int k = 0; k < matches[j].size(); k++)
+            genomeMatches[owners[j]][matches[j][k].genomeName]++;
     }
     
+    fragments.clear();
+    owners.clear();
+}
+
+// Turns the per-genome fragment counts of one query into the list of
+// related genomes, ordered the way findRelatedGenomes() promises
+void GenomeMatcherImpl::rankRelatedGenomes(const LibraryVersion& library, unordered_map<string, int>& genomeMatches, long long numSequences,
+                                           double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
     // For each genome in the library, compute the number of matching sequences found
     // divided by the total number of sequences.
     // If its match percent exceeds the threshold, add it to the results vector
-    for (int i = 0; i < m_genomeLibrary.size(); i++)
+    for (int i = 0; i < library.numGenomes; i++)
     {
-        Genome cur = m_genomeLibrary[i];
+        const Genome& cur = library.genome(i);
         
         double p = ( genomeMatches[cur.name()] / static_cast<double>(numSequences) ) * 100;
 
@@ -243,14 +2361,9 @@ bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatc
         }
     }
     
-    if (results.size() == 0)
-        return false;
-    
     // Vector should be returned in order of highest match, with ties broken
     // by the alphabetical ordering of the genome name
     sort(results.begin(), results.end(), &genomeMatchCompare);
-
-    return true;
 }
 
 bool genomeMatchCompare(const GenomeMatch& a, const GenomeMatch& b)
@@ -273,9 +2386,80 @@ bool genomeMatchCompare(const GenomeMatch& a, const GenomeMatch& b)
 // These functions simply delegate to GenomeMatcherImpl's functions.
 // You probably don't want to change any of this code.
 
+QueryContext::QueryContext()
+{
+    m_impl = new QueryContextImpl;
+}
+
+QueryContext::~QueryContext()
+{
+    delete m_impl;
+}
+
+const vector<DNAMatchRef>& QueryContext::matches() const
+{
+    return m_impl->matches;
+}
+
+IndexOptions::IndexOptions()
+: maxSearchLength(0), maxSeedOccurrences(0), skipAmbiguousSeeds(false), filterBitsPerSeed(0)
+{}
+
+Cancellation::Cancellation()
+: m_flag(make_shared<atomic<bool>>(false))
+{}
+
+void Cancellation::cancel()
+{
+    *m_flag = true;
+}
+
+bool Cancellation::cancelled() const
+{
+    return *m_flag;
+}
+
+QueryOptions::QueryOptions()
+: deadline(chrono::steady_clock::time_point::max())
+{}
+
+BuildProgress::BuildProgress()
+: genomesRead(0), basesRead(0), seedsWritten(0), runsWritten(0), seedsMerged(0)
+{}
+
+ExternalBuildOptions::ExternalBuildOptions()
+: indexPath("seeds.idx"), memoryBudget(1LL << 30)
+{}
+
+FileLoadResult::FileLoadResult()
+: status(FileLoadStatus::Loaded), genomesAdded(0), basesAdded(0)
+{}
+
+FileLoadOptions::FileLoadOptions()
+: readerThreads(2), indexThreads(0), maxQueuedGenomes(16)
+{}
+
+RelatedGenomesOptions::RelatedGenomesOptions()
+: maxResults(0), confidence(0), randomSeed(0), slidingWindows(false)
+{}
+
+KmerCounts::KmerCounts()
+: k(0), totalKmers(0), ambiguousKmersSkipped(0), distinctKmers(0)
+{}
+
+IndexStatistics::IndexStatistics()
+: seedsIndexed(0), distinctSeeds(0), ambiguousSeedsSkipped(0), overRepresentedSeeds(0),
+  postingsDropped(0), mostOccurrences(0), longestPostingList(0)
+{}
+
 GenomeMatcher::GenomeMatcher(int minSearchLength)
 {
-    m_impl = new GenomeMatcherImpl(minSearchLength);
+    m_impl = new GenomeMatcherImpl(minSearchLength, IndexOptions());
+}
+
+GenomeMatcher::GenomeMatcher(int minSearchLength, const IndexOptions& options)
+{
+    m_impl = new GenomeMatcherImpl(minSearchLength, options);
 }
 
 GenomeMatcher::~GenomeMatcher()
@@ -288,18 +2472,91 @@ void GenomeMatcher::addGenome(const Genome& genome)
     m_impl->addGenome(genome);
 }
 
+bool GenomeMatcher::addGenomesFromFile(istream& genomeSource, const ExternalBuildOptions& options)
+{
+    return m_impl->addGenomesFromFile(genomeSource, options);
+}
+
+bool GenomeMatcher::addGenomesFromFiles(const vector<string>& filenames, const FileLoadOptions& options, vector<FileLoadResult>& results)
+{
+    return m_impl->addGenomesFromFiles(filenames, options, results);
+}
+
 int GenomeMatcher::minimumSearchLength() const
 {
     return m_impl->minimumSearchLength();
 }
 
+int GenomeMatcher::maximumSearchLength() const
+{
+    return m_impl->maximumSearchLength();
+}
+
+bool GenomeMatcher::setMinimumSearchLength(int minSearchLength)
+{
+    return m_impl->setMinimumSearchLength(minSearchLength);
+}
+
+void GenomeMatcher::indexStatistics(IndexStatistics& stats) const
+{
+    m_impl->indexStatistics(stats);
+}
+
+bool GenomeMatcher::countKmers(int k, bool sharedCounts, KmerCounts& counts) const
+{
+    return m_impl->countKmers(k, sharedCounts, counts);
+}
+
 bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
 {
     return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches);
 }
 
+bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, QueryContext& context) const
+{
+    return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, context);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNA(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<vector<DNAMatch>>& matches) const
+{
+    return m_impl->findGenomesWithThisDNA(fragments, minimumLength, exactMatchOnly, matches);
+}
+
 bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
 {
     return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
 }
 
+future<DNASearchResult> GenomeMatcher::findGenomesWithThisDNAAsync(const string& fragment, int minimumLength, bool exactMatchOnly,
+                                                                   const QueryOptions& options) const
+{
+    return m_impl->findGenomesWithThisDNAAsync(fragment, minimumLength, exactMatchOnly, options);
+}
+
+future<RelatedGenomesResult> GenomeMatcher::findRelatedGenomesAsync(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold,
+                                                                    const QueryOptions& options) const
+{
+    return m_impl->findRelatedGenomesAsync(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, options);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold,
+                                       const RelatedGenomesOptions& options, vector<GenomeMatch>& results) const
+{
+    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, options, results);
+}
+
+bool GenomeMatcher::findMaximalMatches(const Genome& query, int minimumLength, vector<MaximalMatch>& matches) const
+{
+    return m_impl->findMaximalMatches(query, minimumLength, matches);
+}
+
+bool GenomeMatcher::computeSimilarityMatrix(int fragmentMatchLength, bool exactMatchOnly, ostream& output) const
+{
+    return m_impl->computeSimilarityMatrix(fragmentMatchLength, exactMatchOnly, output);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<vector<GenomeMatch>>& results) const
+{
+    return m_impl->findRelatedGenomes(queries, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+}
+
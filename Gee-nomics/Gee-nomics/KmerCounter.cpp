@@ -0,0 +1,214 @@
+//
+//  KmerCounter.cpp
+//  Gee-nomics
+//
+
+#include "KmerCounter.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+struct KmerRecord
+{
+    uint64_t    code;
+    int         genome;
+};
+
+// What one thread has counted of the partitions it took
+struct PartitionTotals
+{
+    PartitionTotals()
+    : distinctKmers(0)
+    {}
+    
+    long long                   distinctKmers;
+    map<long long, long long>   spectrum;       // occurrences -> distinct k-mers
+    vector<long long>           distinct;       // per genome
+    vector<long long>           unique;         // per genome
+    vector<vector<long long>>   shared;         // per pair of genomes, if wanted
+};
+
+// Partition of a code. The low bits of a code are its last bases, which
+// are skewed in real DNA, so the code is mixed first
+int kmerPartition(uint64_t code)
+{
+    code ^= code >> 33;
+    code *= 0xff51afd7ed558ccdULL;
+    code ^= code >> 33;
+    return code % KMER_PARTITIONS;
+}
+
+// Encodes the genomes handed out through next, scattering their records
+// into partitions
+void scatterKmers(const vector<const Genome*>& genomes, int k, atomic<int>& next,
+                  vector<vector<KmerRecord>>& partitions, vector<long long>& kmers, vector<long long>& ambiguous)
+{
+    partitions.resize(KMER_PARTITIONS);
+    for (int g = next++; g < genomes.size(); g = next++)
+    {
+        visitKmers(*genomes[g], k, ambiguous[g], [&](uint64_t code, long long)
+        {
+            KmerRecord record;
+            record.code = code;
+            record.genome = g;
+            partitions[kmerPartition(code)].push_back(record);
+            kmers[g]++;
+        });
+    }
+}
+
+// Counts the partitions handed out through next, gathering each from
+// every thread's scattered records
+void countPartitions(vector<vector<vector<KmerRecord>>>& scattered, int numGenomes, bool sharedCounts,
+                     atomic<int>& next, PartitionTotals& totals)
+{
+    totals.distinct.assign(numGenomes, 0);
+    totals.unique.assign(numGenomes, 0);
+    if (sharedCounts)
+        totals.shared.assign(numGenomes, vector<long long>(numGenomes, 0));
+    
+    vector<KmerRecord> records;
+    vector<int> holders;        // genomes holding the k-mer being counted
+    for (int p = next++; p < KMER_PARTITIONS; p = next++)
+    {
+        // Each partition is taken by one thread, so its records can be
+        // moved out of the other threads' vectors and freed as we go
+        records.clear();
+        for (int t = 0; t < scattered.size(); t++)
+        {
+            records.insert(records.end(), scattered[t][p].begin(), scattered[t][p].end());
+            vector<KmerRecord>().swap(scattered[t][p]);
+        }
+        
+        sort(records.begin(), records.end(), [](const KmerRecord& a, const KmerRecord& b)
+        {
+            return a.code != b.code ? a.code < b.code : a.genome < b.genome;
+        });
+        
+        for (size_t start = 0; start < records.size(); )
+        {
+            size_t end = start;
+            holders.clear();
+            while (end < records.size() && records[end].code == records[start].code)
+            {
+                if (holders.empty() || holders.back() != records[end].genome)
+                    holders.push_back(records[end].genome);
+                end++;
+            }
+            
+            totals.distinctKmers++;
+            totals.spectrum[end - start]++;
+            for (int i = 0; i < holders.size(); i++)
+            {
+                totals.distinct[holders[i]]++;
+                if (sharedCounts)
+                {
+                    for (int j = i + 1; j < holders.size(); j++)
+                        totals.shared[holders[i]][holders[j]]++;
+                }
+            }
+            if (holders.size() == 1)
+                totals.unique[holders[0]]++;
+            
+            start = end;
+        }
+    }
+}
+
+bool countKmers(const vector<const Genome*>& genomes, int k, bool sharedCounts, int numThreads, KmerCounts& counts)
+{
+    counts = KmerCounts();
+    if (k < 1 || k > MAX_KMER_LENGTH)
+        return false;
+    counts.k = k;
+    
+    numThreads = max(1, numThreads);
+    int numGenomes = genomes.size();
+    vector<long long> kmers(numGenomes, 0);
+    vector<long long> ambiguous(numGenomes, 0);
+    vector<vector<vector<KmerRecord>>> scattered(numThreads);
+    vector<PartitionTotals> totals(numThreads);
+    
+    // Run each phase on the calling thread and numThreads - 1 more
+    auto inParallel = [numThreads](const function<void(int)>& work)
+    {
+        vector<thread> helpers;
+        for (int t = 1; t < numThreads; t++)
+            helpers.push_back(thread(work, t));
+        work(0);
+        for (int t = 0; t < helpers.size(); t++)
+            helpers[t].join();
+    };
+    
+    atomic<int> nextGenome(0);
+    inParallel([&](int t)
+    {
+        scatterKmers(genomes, k, nextGenome, scattered[t], kmers, ambiguous);
+    });
+    
+    atomic<int> nextPartition(0);
+    inParallel([&](int t)
+    {
+        countPartitions(scattered, numGenomes, sharedCounts, nextPartition, totals[t]);
+    });
+    
+    // Add up what the threads counted
+    map<long long, long long> spectrum;
+    counts.genomes.resize(numGenomes);
+    for (int g = 0; g < numGenomes; g++)
+    {
+        GenomeKmerCounts& genome = counts.genomes[g];
+        genome.genomeName = genomes[g]->name();
+        genome.kmers = kmers[g];
+        genome.distinctKmers = 0;
+        genome.uniqueKmers = 0;
+        counts.totalKmers += kmers[g];
+        counts.ambiguousKmersSkipped += ambiguous[g];
+    }
+    if (sharedCounts)
+        counts.shared.assign(numGenomes, vector<long long>(numGenomes, 0));
+    
+    for (int t = 0; t < numThreads; t++)
+    {
+        counts.distinctKmers += totals[t].distinctKmers;
+        for (map<long long, long long>::iterator it = totals[t].spectrum.begin(); it != totals[t].spectrum.end(); it++)
+            spectrum[it->first] += it->second;
+        for (int g = 0; g < numGenomes; g++)
+        {
+            counts.genomes[g].distinctKmers += totals[t].distinct[g];
+            counts.genomes[g].uniqueKmers += totals[t].unique[g];
+            if (sharedCounts)
+            {
+                for (int h = g + 1; h < numGenomes; h++)
+                    counts.shared[g][h] += totals[t].shared[g][h];
+            }
+        }
+    }
+    
+    for (map<long long, long long>::iterator it = spectrum.begin(); it != spectrum.end(); it++)
+    {
+        KmerFrequency frequency;
+        frequency.occurrences = it->first;
+        frequency.distinctKmers = it->second;
+        counts.spectrum.push_back(frequency);
+    }
+    
+    // The matrix was only counted above the diagonal
+    if (sharedCounts)
+    {
+        for (int g = 0; g < numGenomes; g++)
+        {
+            counts.shared[g][g] = counts.genomes[g].distinctKmers;
+            for (int h = g + 1; h < numGenomes; h++)
+                counts.shared[h][g] = counts.shared[g][h];
+        }
+    }
+    
+    return true;
+}
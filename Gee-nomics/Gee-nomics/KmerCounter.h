@@ -0,0 +1,97 @@
+//
+//  KmerCounter.h
+//  Gee-nomics
+//
+
+#ifndef KMERCOUNTER_INCLUDED
+#define KMERCOUNTER_INCLUDED
+
+#include "provided.h"
+#include "Trie.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+// K-MER COUNTING
+//
+// countKmers() counts every k-mer (window of k bases) of a set of
+// genomes. A k-mer is packed two bits a base into a 64 bit code, so k
+// can be at most 32, and the code is rolled along the genome a base at
+// a time rather than being rebuilt for every window. Windows with N
+// aren't counted.
+//
+// The count is a partitioned radix count spread over threads. First
+// each thread takes genomes and scatters a (code, genome) record for
+// every window into KMER_PARTITIONS partitions, chosen by a hash of the
+// code so that every record of a k-mer lands in the same partition.
+// Then each thread takes whole partitions, sorts them, and counts the
+// runs of equal codes. Nothing is locked, and the threads' totals are
+// only added up once they are done.
+//
+// Every window holds a 16 byte record until its partition is counted,
+// so counting takes about 16 bytes per base of the genomes.
+
+const int MAX_KMER_LENGTH = 32;
+
+// Number of partitions. Enough that the threads stay evenly loaded,
+// few enough that each thread's partitions don't thrash the cache
+const int KMER_PARTITIONS = 256;
+
+// Bases of a genome extracted at a time while rolling over it
+const int KMER_CHUNK_BASES = 1 << 20;
+
+bool countKmers(const vector<const Genome*>& genomes, int k, bool sharedCounts, int numThreads, KmerCounts& counts);
+// Counts the k-mers of genomes on numThreads threads, the calling
+// thread being one of them. counts.genomes[i] is for genomes[i], and
+// counts.shared is filled in only if sharedCounts is true. Returns
+// false, leaving counts empty, unless 1 <= k <= MAX_KMER_LENGTH
+
+template<typename Visitor>
+void visitKmers(const Genome& genome, int k, long long& ambiguousKmersSkipped, Visitor visit);
+// Calls visit(code, position) for every window of k bases of genome
+// without N, in order. A base's code is its rank in DNAAlphabet, and
+// the first base of the window is in the highest bits
+
+template<typename Visitor>
+void visitKmers(const Genome& genome, int k, long long& ambiguousKmersSkipped, Visitor visit)
+{
+    uint64_t mask = k >= MAX_KMER_LENGTH ? ~0ULL : (1ULL << (2 * k)) - 1;
+    uint64_t code = 0;
+    int run = 0;        // bases since the last N
+    
+    string chunk;
+    for (long long start = 0; start < genome.length(); start += KMER_CHUNK_BASES)
+    {
+        int length = min<long long>(KMER_CHUNK_BASES, genome.length() - start);
+        if (!genome.extract(start, length, chunk))
+            return;
+        
+        for (int i = 0; i < length; i++)
+        {
+            int r = DNAAlphabet::rank(chunk[i]);
+            if (r < 0 || r > 3)
+            {
+                code = 0;
+                run = 0;
+            }
+            else
+            {
+                code = ((code << 2) | r) & mask;
+                run++;
+            }
+            
+            // The window ending at this base
+            long long position = start + i + 1 - k;
+            if (position < 0)
+                continue;
+            if (run >= k)
+                visit(code, position);
+            else
+                ambiguousKmersSkipped++;
+        }
+    }
+}
+
+#endif // KMERCOUNTER_INCLUDED
@@ -0,0 +1,57 @@
+//
+//  Posting.h
+//  Gee-nomics
+//
+
+#ifndef POSTING_INCLUDED
+#define POSTING_INCLUDED
+
+// POSTINGS
+//
+// A posting records where an indexed seed occurs, as the offset of the
+// seed's first base in the bases of an index segment's genomes laid end
+// to end. The segment keeps where each of its genomes starts, so the
+// genome and the position in it are found from the offset.
+//
+// The offset is kept in 40 bits, so a segment can hold about a trillion
+// bases, while a posting takes 5 bytes rather than the 8 a pair of ints
+// would. There is a posting for every base indexed, so postings are
+// most of an index's size.
+
+const int POSTING_BYTES = 5;
+const long long MAX_POSTING_OFFSET = (1LL << (8 * POSTING_BYTES)) - 1;
+
+class Posting
+{
+public:
+    Posting();
+    explicit Posting(long long offset);
+    // offset must be between 0 and MAX_POSTING_OFFSET
+    
+    long long offset() const;
+
+private:
+    // Low byte first. Bytes rather than an integer, so postings pack with
+    // no padding wherever they are kept
+    unsigned char   m_bytes[POSTING_BYTES];
+};
+
+inline Posting::Posting()
+: Posting(0)
+{}
+
+inline Posting::Posting(long long offset)
+{
+    for (int i = 0; i < POSTING_BYTES; i++)
+        m_bytes[i] = static_cast<unsigned char>(offset >> (8 * i));
+}
+
+inline long long Posting::offset() const
+{
+    long long offset = 0;
+    for (int i = 0; i < POSTING_BYTES; i++)
+        offset |= static_cast<long long>(m_bytes[i]) << (8 * i);
+    return offset;
+}
+
+#endif // POSTING_INCLUDED
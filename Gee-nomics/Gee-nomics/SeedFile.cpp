@@ -0,0 +1,405 @@
+//
+//  SeedFile.cpp
+//  Gee-nomics
+//
+
+#include "SeedFile.h"
+#include "Trie.h"
+#include <string>
+#include <vector>
+#include <queue>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+// Postings merged between calls to the progress callback
+const long long MERGE_PROGRESS_INTERVAL = 1 << 20;
+
+// Creates an empty file at path, failing rather than touching a file
+// that is already there
+static bool createFile(const string& path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return false;
+    close(fd);
+    return true;
+}
+
+//******************** SeedFileWriter functions ****************************
+
+SeedFileWriter::SeedFileWriter(const string& path, int keyLength, long long memoryBudget)
+: m_path(path), m_keyLength(keyLength), m_recordSize(keyLength + POSTING_BYTES), m_finished(false)
+{
+    // Each buffered record also needs an index for sorting
+    m_maxBuffered = max<long long>(1, memoryBudget / (m_recordSize + sizeof(int)));
+    m_maxBuffered = min<size_t>(m_maxBuffered, INT_MAX);
+    
+    m_progress.postingsWritten = 0;
+    m_progress.runsWritten = 0;
+    m_progress.postingsMerged = 0;
+    
+    // The buffer is reserved up front, since growing it as records are
+    // added could leave it holding nearly twice the budget
+    m_created = createFile(m_path);
+    if (m_created)
+        m_buffer.reserve(m_maxBuffered * m_recordSize);
+}
+
+SeedFileWriter::~SeedFileWriter()
+{
+    for (int i = 0; i < m_runs.size(); i++)
+        remove(m_runs[i].c_str());
+    
+    if (m_created && !m_finished)
+        remove(m_path.c_str());
+}
+
+bool SeedFileWriter::created() const
+{
+    return m_created;
+}
+
+bool SeedFileWriter::add(const string& key, const Posting& posting)
+{
+    if (!m_created)
+        return false;
+    
+    // Append the record, padding the key out to its full length
+    size_t at = m_buffer.size();
+    m_buffer.resize(at + m_recordSize, '\0');
+    memcpy(&m_buffer[at], key.data(), min<size_t>(key.size(), m_keyLength));
+    memcpy(&m_buffer[at + m_keyLength], &posting, POSTING_BYTES);
+    
+    if (m_buffer.size() / m_recordSize >= m_maxBuffered)
+        return spillRun();
+    return true;
+}
+
+// Sorts the buffered records and writes them out as the next run
+bool SeedFileWriter::spillRun()
+{
+    int numRecords = m_buffer.size() / m_recordSize;
+    if (numRecords == 0)
+        return true;
+    
+    // Sort indexes into the buffer rather than moving whole records around
+    vector<int> order(numRecords);
+    for (int i = 0; i < numRecords; i++)
+        order[i] = i;
+    
+    const char* buffer = m_buffer.data();
+    int keyLength = m_keyLength;
+    int recordSize = m_recordSize;
+    sort(order.begin(), order.end(), [buffer, keyLength, recordSize](int a, int b)
+    {
+        const char* ra = buffer + a * recordSize;
+        const char* rb = buffer + b * recordSize;
+        int c = memcmp(ra, rb, keyLength);
+        if (c != 0)
+            return c < 0;
+        
+        // Equal keys keep the order they were added in, which is
+        // the order of their offsets
+        return a < b;
+    });
+    
+    // A run is only ever written to a file of its own making
+    string runPath = m_path + ".run" + to_string(m_runs.size());
+    if (!createFile(runPath))
+        return false;
+    m_runs.push_back(runPath);
+    
+    ofstream run(runPath, ios::binary);
+    for (int i = 0; i < numRecords && run; i++)
+        run.write(buffer + order[i] * recordSize, recordSize);
+    run.close();
+    if (!run)
+        return false;
+    
+    m_buffer.clear();
+    m_progress.postingsWritten += numRecords;
+    m_progress.runsWritten++;
+    return true;
+}
+
+bool SeedFileWriter::finish(const function<void(const SeedFileProgress&)>& progress)
+{
+    if (!m_created || !spillRun())
+        return false;
+    
+    // The buffer's memory is the merge's to use now
+    vector<char>().swap(m_buffer);
+    
+    if (progress)
+        progress(m_progress);
+    
+    // One cursor per run, holding the run's next record
+    struct Cursor
+    {
+        ifstream    in;
+        string      record;
+    };
+    vector<Cursor> cursors(m_runs.size());
+    
+    // The heap holds the cursors that still have records, smallest
+    // record on top. Records with equal keys come off in run order,
+    // and runs were spilled in the order postings were added
+    int keyLength = m_keyLength;
+    auto later = [&cursors, keyLength](int a, int b)
+    {
+        int c = memcmp(cursors[a].record.data(), cursors[b].record.data(), keyLength);
+        return c != 0 ? c > 0 : a > b;
+    };
+    priority_queue<int, vector<int>, decltype(later)> heap(later);
+    
+    for (int i = 0; i < m_runs.size(); i++)
+    {
+        cursors[i].in.open(m_runs[i], ios::binary);
+        cursors[i].record.resize(m_recordSize);
+        if (cursors[i].in.read(&cursors[i].record[0], m_recordSize))
+            heap.push(i);
+    }
+    
+    ofstream out(m_path, ios::binary);
+    while (!heap.empty() && out)
+    {
+        int i = heap.top();
+        heap.pop();
+        out.write(cursors[i].record.data(), m_recordSize);
+        
+        if (cursors[i].in.read(&cursors[i].record[0], m_recordSize))
+            heap.push(i);
+        
+        m_progress.postingsMerged++;
+        if (progress && m_progress.postingsMerged % MERGE_PROGRESS_INTERVAL == 0)
+            progress(m_progress);
+    }
+    out.close();
+    
+    if (!out || m_progress.postingsMerged != m_progress.postingsWritten)
+        return false;
+    
+    if (progress)
+        progress(m_progress);
+    
+    m_finished = true;
+    return true;
+}
+
+const SeedFileProgress& SeedFileWriter::progress() const
+{
+    return m_progress;
+}
+
+//******************** SeedFile functions **********************************
+
+SeedFile::SeedFile(int maxValuesPerKey)
+: m_fd(-1), m_keyLength(0), m_recordSize(0), m_records(0), m_maxValuesPerKey(maxValuesPerKey)
+{}
+
+SeedFile::~SeedFile()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        remove(m_path.c_str());
+    }
+}
+
+bool SeedFile::open(const string& path, int keyLength)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    
+    off_t size = lseek(fd, 0, SEEK_END);
+    int recordSize = keyLength + POSTING_BYTES;
+    if (size < 0 || size % recordSize != 0)
+    {
+        close(fd);
+        return false;
+    }
+    
+    m_fd = fd;
+    m_path = path;
+    m_keyLength = keyLength;
+    m_recordSize = recordSize;
+    m_records = size / recordSize;
+    
+    // Keep the first key of every block, so a lookup can find the
+    // block to read without going to disk
+    m_firstKeys.clear();
+    vector<char> record;
+    for (long long first = 0; first < m_records; first += SEED_FILE_BLOCK_RECORDS)
+    {
+        if (!readRecords(first, 1, record))
+            return false;
+        m_firstKeys.append(record.data(), m_keyLength);
+    }
+    
+    return true;
+}
+
+// Reads records first .. first + n - 1 into records. pread() leaves the
+// file offset alone, so lookups on several threads can share m_fd
+bool SeedFile::readRecords(long long first, long long n, vector<char>& records) const
+{
+    records.resize(n * m_recordSize);
+    size_t done = 0;
+    while (done < records.size())
+    {
+        ssize_t got = pread(m_fd, &records[done], records.size() - done, first * m_recordSize + done);
+        if (got <= 0)
+            return false;
+        done += got;
+    }
+    return true;
+}
+
+// Compares the first length bytes of record's key with key padded
+// with '\0' to length, as memcmp() does
+int SeedFile::compareKey(const char* record, const string& key, int length) const
+{
+    int common = min<int>(key.size(), length);
+    int c = memcmp(record, key.data(), common);
+    if (c != 0)
+        return c;
+    
+    for (int i = common; i < length; i++)
+    {
+        if (record[i] != '\0')
+            return 1;
+    }
+    return 0;
+}
+
+// Returns the index of the first record whose first length bytes of key
+// compare greater than key (after), or not less than key (!after).
+// m_records if there is no such record
+long long SeedFile::lowerBound(const string& key, int length, bool after) const
+{
+    auto past = [&](const char* record)
+    {
+        int c = compareKey(record, key, length);
+        return after ? c > 0 : c >= 0;
+    };
+    
+    // Find the last block whose first record is not past key. The
+    // record we want is in that block or starts the next one
+    long long numBlocks = m_firstKeys.size() / m_keyLength;
+    long long lo = 0;
+    long long hi = numBlocks;
+    while (lo < hi)
+    {
+        long long mid = (lo + hi) / 2;
+        if (past(&m_firstKeys[mid * m_keyLength]))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo == 0)
+        return 0;
+    
+    long long block = lo - 1;
+    long long first = block * SEED_FILE_BLOCK_RECORDS;
+    long long n = min<long long>(SEED_FILE_BLOCK_RECORDS, m_records - first);
+    vector<char> records;
+    if (!readRecords(first, n, records))
+        return m_records;
+    
+    for (long long r = 1; r < n; r++)
+    {
+        if (past(&records[r * m_recordSize]))
+            return first + r;
+    }
+    return first + n;
+}
+
+Posting SeedFile::posting(const char* record) const
+{
+    Posting p;
+    memcpy(&p, record + m_keyLength, POSTING_BYTES);
+    return p;
+}
+
+long long SeedFile::count(const string& key, bool prefix) const
+{
+    // A prefix count takes every record whose key starts with key
+    int length = prefix ? min<int>(key.size(), m_keyLength) : m_keyLength;
+    return lowerBound(key, length, true) - lowerBound(key, length, false);
+}
+
+// Adds the postings of key, and if prefix is true those of every longer
+// key starting with it, to postings
+void SeedFile::findKey(const string& key, bool prefix, vector<Posting>& postings) const
+{
+    // Keys longer than the ones stored can't match anything
+    if (key.size() > m_keyLength)
+        return;
+    
+    int length = prefix ? key.size() : m_keyLength;
+    long long first = lowerBound(key, length, false);
+    long long last = lowerBound(key, length, true);
+    if (first >= last)
+        return;
+    
+    vector<char> records;
+    if (!readRecords(first, last - first, records))
+        return;
+    
+    // Keys with more postings than the limit hold none, as in a Trie
+    long long n = last - first;
+    for (long long start = 0; start < n; )
+    {
+        long long end = start + 1;
+        while (end < n && memcmp(&records[start * m_recordSize], &records[end * m_recordSize], m_keyLength) == 0)
+            end++;
+        
+        if (m_maxValuesPerKey <= 0 || end - start <= m_maxValuesPerKey)
+        {
+            for (long long r = start; r < end; r++)
+                postings.push_back(posting(&records[r * m_recordSize]));
+        }
+        start = end;
+    }
+}
+
+void SeedFile::find(const string& key, bool exactMatchOnly, vector<Posting>& postings, bool prefix) const
+{
+    postings.clear();
+    findKey(key, prefix, postings);
+    
+    if (exactMatchOnly)
+        return;
+    
+    // As in a Trie, the first base must match, and any one base
+    // after it may be replaced by any other in the alphabet
+    string variant = key;
+    for (int d = 1; d < key.size(); d++)
+    {
+        for (int r = 0; r < DNAAlphabet::SIZE; r++)
+        {
+            if (r == DNAAlphabet::rank(key[d]))
+                continue;
+            variant[d] = DNAAlphabet::symbol(r);
+            findKey(variant, prefix, postings);
+        }
+        variant[d] = key[d];
+    }
+}
+
+void SeedFile::findBatch(const vector<string>& keys, bool exactMatchOnly,
+                         vector<vector<Posting>>& results, bool prefix) const
+{
+    results.clear();
+    results.resize(keys.size());
+    
+    for (int i = 0; i < keys.size(); i++)
+        find(keys[i], exactMatchOnly, results[i], prefix);
+}
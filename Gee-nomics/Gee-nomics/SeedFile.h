@@ -0,0 +1,175 @@
+//
+//  SeedFile.h
+//  Gee-nomics
+//
+
+#ifndef SEEDFILE_INCLUDED
+#define SEEDFILE_INCLUDED
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <algorithm>
+#include "Posting.h"
+using namespace std;
+
+// SEED FILES
+//
+// A seed file is a seed index kept on disk rather than in a Trie, for
+// libraries whose index would not fit in memory. It holds one fixed
+// size record per posting, sorted by key, with the postings of one key
+// in the order they were added:
+//  - the key, padded with '\0' to keyLength bytes. A shorter key sorts
+//    before every longer key that starts with it, just as strings do
+//  - the posting, POSTING_BYTES bytes
+// The file is a working file of the process that wrote it, not an
+// interchange format.
+//
+// A SeedFileWriter builds one in bounded memory by spilling sorted runs
+// next to the file and merging them once every posting has been added.
+// A SeedFile then answers the same questions as a Trie of DNA keys,
+// reading from disk only the blocks of records a lookup needs.
+
+// Number of records in a block. The key of each block's first record
+// is kept in memory, so one lookup reads about one block from disk
+const int SEED_FILE_BLOCK_RECORDS = 512;
+
+// Progress of a SeedFileWriter. Postings are first written to sorted
+// runs, then merged into the seed file
+struct SeedFileProgress
+{
+    long long   postingsWritten;    // to runs, so far
+    int         runsWritten;
+    long long   postingsMerged;     // into the seed file, out of postingsWritten
+};
+
+class SeedFileWriter
+{
+public:
+    SeedFileWriter(const std::string& path, int keyLength, long long memoryBudget);
+    // Creates the seed file at path, empty until finish() fills it, unless
+    // there is already a file there. At most memoryBudget bytes of
+    // postings, and their indexes for sorting, are held in memory before
+    // they are spilled as a run
+    
+    ~SeedFileWriter();
+    // Removes any runs still on disk, and the seed file too if the
+    // constructor created it and finish() didn't succeed
+    
+    bool created() const;
+    // Returns false if the constructor couldn't create the seed file.
+    // Nothing can be added to the writer then
+    
+    bool add(const std::string& key, const Posting& posting);
+    // Adds a posting. Keys longer than keyLength are cut short.
+    // Returns false if a run could not be written. Each run is spilled
+    // to path with ".run" and its number appended, and if a file is
+    // already there the run is not written
+    
+    bool finish(const std::function<void(const SeedFileProgress&)>& progress);
+    // Merges the runs into the seed file, calling progress, if it is set,
+    // every so often along the way. Returns false if the file could not
+    // be written. Nothing may be added afterwards
+    
+    const SeedFileProgress& progress() const;
+    
+    SeedFileWriter(const SeedFileWriter&) = delete;
+    SeedFileWriter& operator=(const SeedFileWriter&) = delete;
+private:
+    std::string             m_path;
+    int                     m_keyLength;
+    int                     m_recordSize;
+    size_t                  m_maxBuffered;      // records held before a run is spilled
+    std::vector<char>       m_buffer;           // unsorted records not yet spilled
+    std::vector<std::string> m_runs;            // paths of the runs spilled so far
+    SeedFileProgress        m_progress;
+    bool                    m_created;          // the constructor created the seed file
+    bool                    m_finished;
+    
+    bool spillRun();
+};
+
+class SeedFile
+{
+public:
+    SeedFile(int maxValuesPerKey = 0);
+    // As for a Trie, if maxValuesPerKey is positive, a key with more
+    // postings than that is treated as holding none
+    
+    ~SeedFile();
+    // Closes the seed file and removes it from disk
+    
+    bool open(const std::string& path, int keyLength);
+    // Opens a seed file finished by a SeedFileWriter with the same
+    // keyLength, and takes ownership of it. Returns false if it can't
+    
+    long long count(const std::string& key, bool prefix = false) const;
+    void find(const std::string& key, bool exactMatchOnly, std::vector<Posting>& postings, bool prefix = false) const;
+    void findBatch(const std::vector<std::string>& keys, bool exactMatchOnly,
+                   std::vector<std::vector<Posting>>& results, bool prefix = false) const;
+    template<typename Visitor>
+    void visitKeys(Visitor visit) const;
+    // Same as the Trie functions of the same names, with postings as the
+    // values. Postings come back in file order
+    // rather than the order they were added in. A lookup that allows a
+    // mismatch looks up every key one substitution away from the key.
+    // Unlike a Trie's, lookups allocate buffers for what they read
+    
+    SeedFile(const SeedFile&) = delete;
+    SeedFile& operator=(const SeedFile&) = delete;
+private:
+    int                 m_fd;               // -1 if not open
+    std::string         m_path;
+    int                 m_keyLength;
+    int                 m_recordSize;
+    long long           m_records;
+    std::string         m_firstKeys;        // key of each block's first record, back to back
+    int                 m_maxValuesPerKey;  // 0 if there is no limit
+    
+    bool readRecords(long long first, long long n, std::vector<char>& records) const;
+    int compareKey(const char* record, const std::string& key, int length) const;
+    long long lowerBound(const std::string& key, int length, bool after) const;
+    Posting posting(const char* record) const;
+    void findKey(const std::string& key, bool prefix, std::vector<Posting>& postings) const;
+};
+
+template<typename Visitor>
+void SeedFile::visitKeys(Visitor visit) const
+{
+    // Read the file a block at a time, carrying the postings of the key
+    // we are in the middle of over to the next block
+    std::string key;
+    long long count = 0;
+    std::vector<Posting> postings;
+    std::vector<char> block;
+    
+    for (long long first = 0; first < m_records; first += SEED_FILE_BLOCK_RECORDS)
+    {
+        long long n = std::min<long long>(SEED_FILE_BLOCK_RECORDS, m_records - first);
+        if (!readRecords(first, n, block))
+            return;
+        
+        for (long long r = 0; r < n; r++)
+        {
+            const char* record = &block[r * m_recordSize];
+            if (count > 0 && compareKey(record, key, m_keyLength) != 0)
+            {
+                visit(count, postings);
+                count = 0;
+                postings.clear();
+            }
+            if (count == 0)
+                key.assign(record, m_keyLength);
+            
+            count++;
+            if (m_maxValuesPerKey <= 0 || postings.size() < m_maxValuesPerKey)
+                postings.push_back(posting(record));
+        }
+    }
+    
+    if (count > 0)
+        visit(count, postings);
+}
+
+#endif // SEEDFILE_INCLUDED
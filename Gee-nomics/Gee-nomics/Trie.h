@@ -11,19 +11,134 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 using namespace std;
 
-// Assume that characters are 1 byte and
-// can be converted to integers
-const int POSSIBLE_CHARACTERS = 256;
+// ALPHABETS
+//
+// A Trie is parameterized by the alphabet its keys are drawn from.
+// An alphabet is a type with
+//  - SIZE, the number of symbols in the alphabet
+//  - rank(c), which maps a character to 0 .. SIZE - 1,
+//    or -1 if c is not in the alphabet
+//  - symbol(r), which maps a rank back to its character
+// Each node holds exactly SIZE child pointers, so a small alphabet
+// gives a small trie.
 
-template<typename ValueType>
+// Any 1 byte character, for keys that are not biological sequences
+struct ByteAlphabet
+{
+    static constexpr int SIZE = 256;
+    static constexpr int rank(char c) { return static_cast<unsigned char>(c); }
+    static constexpr char symbol(int r) { return static_cast<char>(r); }
+};
+
+// The bases a Genome can contain: A, C, G, T, and N for an unknown base
+struct DNAAlphabet
+{
+    static constexpr int SIZE = 5;
+    static constexpr int rank(char c)
+    {
+        switch (c)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            case 'N': return 4;
+            default:  return -1;
+        }
+    }
+    static constexpr char symbol(int r) { return "ACGTN"[r]; }
+};
+
+// The IUPAC nucleotide codes, including the ambiguity codes for sets
+// of bases. U (uracil) is treated as T
+struct IUPACNucleotideAlphabet
+{
+    static constexpr int SIZE = 15;
+    static constexpr int rank(char c)
+    {
+        switch (c)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            case 'U': return 3;
+            case 'R': return 4;
+            case 'Y': return 5;
+            case 'S': return 6;
+            case 'W': return 7;
+            case 'K': return 8;
+            case 'M': return 9;
+            case 'B': return 10;
+            case 'D': return 11;
+            case 'H': return 12;
+            case 'V': return 13;
+            case 'N': return 14;
+            default:  return -1;
+        }
+    }
+    static constexpr char symbol(int r) { return "ACGTRYSWKMBDHVN"[r]; }
+};
+
+// The 20 standard amino acids, by their one letter codes
+struct ProteinAlphabet
+{
+    static constexpr int SIZE = 20;
+    static constexpr int rank(char c)
+    {
+        switch (c)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'D': return 2;
+            case 'E': return 3;
+            case 'F': return 4;
+            case 'G': return 5;
+            case 'H': return 6;
+            case 'I': return 7;
+            case 'K': return 8;
+            case 'L': return 9;
+            case 'M': return 10;
+            case 'N': return 11;
+            case 'P': return 12;
+            case 'Q': return 13;
+            case 'R': return 14;
+            case 'S': return 15;
+            case 'T': return 16;
+            case 'V': return 17;
+            case 'W': return 18;
+            case 'Y': return 19;
+            default:  return -1;
+        }
+    }
+    static constexpr char symbol(int r) { return "ACDEFGHIKLMNPQRSTVWY"[r]; }
+};
+
+// Number of lookups findBatch() keeps in flight at once. Large enough
+// to cover a main memory miss with useful work, small enough that the
+// prefetched nodes are still in cache when we come back to them
+const int BATCH_LOOKUP_WINDOW = 16;
+
+// Hint to the CPU that we will soon read the memory at address p
+#if defined(__GNUC__) || defined(__clang__)
+#define TRIE_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define TRIE_PREFETCH(p) ((void)(p))
+#endif
+
+template<typename ValueType, typename Alphabet = ByteAlphabet>
 class Trie
 {
 public:
-    Trie();
+    Trie(int maxValuesPerKey = 0);
     // Initializes one new Node into the Trie structure and
-    // points m_root at it
+    // points m_root at it. If maxValuesPerKey is positive, at most that
+    // many values are kept for any one key; further values are counted
+    // but dropped, and since the values kept would be an arbitrary subset,
+    // find() treats such a key as holding no values at all
     
     ~Trie();
     // Frees all memory used up by the Trie
@@ -32,16 +147,53 @@ public:
     // Frees all memory used by the Trie then
     // initializes a new empty node that m_root points to
     
-    void insert(const std::string& key, const ValueType& value);
-    // Associates the specified key with a specified value
+    bool insert(const std::string& key, const ValueType& value);
+    // Associates the specified key with a specified value.
+    // Returns false, and stores nothing, if the key contains a
+    // character that is not in the Trie's alphabet
+    
+    long long count(const std::string& key, bool prefix = false) const;
+    // Returns the number of values that have been inserted with exactly
+    // this key, including any that were dropped. If prefix is true, also
+    // counts the values of every longer key that starts with this one
+    
+    template<typename Visitor>
+    void visitKeys(Visitor visit) const;
+    // Calls visit(count, values) for every key that has been inserted,
+    // where count is as for count() and values are the ones kept
     
-    std::vector<ValueType> find(const std::string& key, bool exactMatchOnly) const;
+    template<typename Transform>
+    void insertAll(const Trie& other, Transform transform);
+    // Associates every key in other with each of its values, after
+    // passing the value through transform. Walks both tries together,
+    // so it is much cheaper than inserting other's keys one at a time.
+    // Counts carry over, including values other had already dropped
+    
+    std::vector<ValueType> find(const std::string& key, bool exactMatchOnly, bool prefix = false) const;
     // Searches for the values associated with a given key.
     // User can specify if values exactly matching the search key should be
     // returned (exactMatchOnly == true), or values that
     //     - match the first character of the key exactly
     //     - have a single mismatching character of the key
     //       anywhere past the first character
+    // A character outside the alphabet never matches exactly, but may
+    // be the one mismatch. If prefix is true, the values of every longer
+    // key that starts with a matching key are returned as well
+    
+    void find(const std::string& key, bool exactMatchOnly, std::vector<ValueType>& values, bool prefix = false) const;
+    // Same as above, but leaves the values in values, reusing the memory
+    // it already has, so a caller that keeps values between lookups
+    // doesn't allocate once it has grown large enough
+    
+    void findBatch(const std::vector<std::string>& keys, bool exactMatchOnly,
+                   std::vector<std::vector<ValueType>>& results, bool prefix = false) const;
+    // Same as calling find() for every key, with results[i] holding the
+    // values for keys[i]. Rather than finishing one lookup before starting
+    // the next, up to BATCH_LOOKUP_WINDOW lookups advance in lockstep one
+    // node at a time, and each node is prefetched when it is queued, so the
+    // cache misses of different lookups overlap instead of adding up.
+    // Values for one key may come back in a different order than find()
+    // returns them when exactMatchOnly is false
     
     // C++11 syntax for preventing copying and assignment
     Trie(const Trie&) = delete;
@@ -50,115 +202,269 @@ private:
     
     // Node representation:
     //  - Vector of values present in the node
+    //  - Number of values inserted at the node, kept or not
+    //  - Number of values inserted at the node and all its descendants
     //  - Array of node pointers to children, one
-    //    pointer for each possible character
+    //    pointer for each symbol in the alphabet
     struct Node
     {
         Node()
+        : m_count(0), m_prefixCount(0)
         {
-            for (int i = 0; i < POSSIBLE_CHARACTERS; i++)
+            for (int i = 0; i < Alphabet::SIZE; i++)
                 m_children[i] = nullptr;
         }
         
+        // Child for character c, or nullptr if there is none
+        // or c is not in the alphabet
+        Node* child(char c) const
+        {
+            int r = Alphabet::rank(c);
+            return r < 0 ? nullptr : m_children[r];
+        }
+        
         vector<ValueType>   m_values;
-        Node*               m_children[POSSIBLE_CHARACTERS];
+        int                 m_count;
+        long long           m_prefixCount;
+        Node*               m_children[Alphabet::SIZE];
     };
     
     Node*   m_root;
+    int     m_maxValuesPerKey;      // 0 if there is no limit
+    
+    // One step of an in-flight findBatch() lookup: the node reached
+    // after consuming depth characters of keys[query]. In a prefix
+    // lookup, depth stays at the key's length while we visit the
+    // descendants of the node the key led to
+    struct LookupState
+    {
+        int     query;
+        int     depth;
+        bool    exactMatchOnly;
+        Node*   node;
+    };
     
     // PRIVATE HELPER FUNCTIONS
     void freeAllNodes(Node* root);
-    void findHelper(const std::string& key, bool exactMatchOnly, Node* t, vector<ValueType>& v) const;
+    bool truncated(const Node* t) const;
+    void addValue(Node* t, const ValueType& value);
+    template<typename Visitor>
+    void visitKeysHelper(const Node* t, Visitor& visit) const;
+    template<typename Transform>
+    void insertAllHelper(Node* dst, const Node* src, Transform& transform);
+    void findHelper(const std::string& key, int depth, bool exactMatchOnly, bool prefix, Node* t, vector<ValueType>& v) const;
+    void collectValues(const Node* t, bool prefix, vector<ValueType>& v) const;
+    void queueLookup(deque<LookupState>& pending, const std::string& key, int query,
+                     int depth, bool exactMatchOnly, Node* t) const;
 };
 
-template<typename ValueType>
-Trie<ValueType>::Trie()
+template<typename ValueType, typename Alphabet>
+Trie<ValueType, Alphabet>::Trie(int maxValuesPerKey)
+: m_maxValuesPerKey(maxValuesPerKey)
 {
     m_root = new Node();
 }
 
-template<typename ValueType>
-Trie<ValueType>::~Trie()
+template<typename ValueType, typename Alphabet>
+Trie<ValueType, Alphabet>::~Trie()
 {
     freeAllNodes(m_root);
 }
 
-template<typename ValueType>
-void Trie<ValueType>::reset()
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::reset()
 {
     freeAllNodes(m_root);
     m_root = new Node();
 }
 
-template<typename ValueType>
-void Trie<ValueType>::freeAllNodes(Node* root)
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::freeAllNodes(Node* root)
 {
     if (root != nullptr)
     {
-        for (int i = 0; i < POSSIBLE_CHARACTERS; i++)
+        for (int i = 0; i < Alphabet::SIZE; i++)
             freeAllNodes(root->m_children[i]);
-
+        
         delete root;
     }
 }
 
+// Whether values were dropped at node t, so it holds an incomplete set
+template<typename ValueType, typename Alphabet>
+bool Trie<ValueType, Alphabet>::truncated(const Node* t) const
+{
+    return t->m_count > t->m_values.size();
+}
+
+// Counts value at node t, and keeps it if there is still room
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::addValue(Node* t, const ValueType& value)
+{
+    t->m_count++;
+    if (m_maxValuesPerKey <= 0 || t->m_values.size() < m_maxValuesPerKey)
+        t->m_values.push_back(value);
+}
+
 
-template<typename ValueType>
-void Trie<ValueType>::insert(const std::string& key, const ValueType& value)
+template<typename ValueType, typename Alphabet>
+bool Trie<ValueType, Alphabet>::insert(const std::string& key, const ValueType& value)
 {
-    string sequence = key;
+    // Check the whole key first so a bad key leaves no empty path behind
+    for (int i = 0; i < key.size(); i++)
+    {
+        if (Alphabet::rank(key[i]) < 0)
+            return false;
+    }
+    
     Node* curNode = m_root;         // pointer to the currrent Node
+    curNode->m_prefixCount++;
     
-    while (sequence != "")
+    for (int i = 0; i < key.size(); i++)
     {
-        char firstChar = sequence[0];       // the first character in the current sequence
+        int r = Alphabet::rank(key[i]);     // slot of the current character
         
         // If the current node does not have a path to the current character
         // Initialize a new node that the character slot points to
-        if (curNode->m_children[firstChar] == nullptr)
-            curNode->m_children[firstChar] = new Node();
+        if (curNode->m_children[r] == nullptr)
+            curNode->m_children[r] = new Node();
         
         // Make pointer to curNode move forward in the path
-        curNode = curNode->m_children[firstChar];
-        
-        sequence = sequence.substr(1);
+        curNode = curNode->m_children[r];
+        curNode->m_prefixCount++;
     }
     
     // curNode points to the node that corresponds to the key.
     // Insert the value at that node
-    curNode->m_values.push_back(value);
+    addValue(curNode, value);
+    return true;
+}
+
+
+template<typename ValueType, typename Alphabet>
+long long Trie<ValueType, Alphabet>::count(const std::string& key, bool prefix) const
+{
+    Node* curNode = m_root;
+    
+    for (int i = 0; i < key.size() && curNode != nullptr; i++)
+        curNode = curNode->child(key[i]);
+    
+    if (curNode == nullptr)
+        return 0;
+    
+    return prefix ? curNode->m_prefixCount : curNode->m_count;
+}
+
+
+template<typename ValueType, typename Alphabet>
+template<typename Visitor>
+void Trie<ValueType, Alphabet>::visitKeys(Visitor visit) const
+{
+    visitKeysHelper(m_root, visit);
+}
+
+template<typename ValueType, typename Alphabet>
+template<typename Visitor>
+void Trie<ValueType, Alphabet>::visitKeysHelper(const Node* t, Visitor& visit) const
+{
+    if (t->m_count > 0)
+        visit(t->m_count, t->m_values);
+    
+    for (int i = 0; i < Alphabet::SIZE; i++)
+    {
+        if (t->m_children[i] != nullptr)
+            visitKeysHelper(t->m_children[i], visit);
+    }
 }
 
 
-template<typename ValueType>
-std::vector<ValueType> Trie<ValueType>::find(const std::string& key, bool exactMatchOnly) const
+template<typename ValueType, typename Alphabet>
+template<typename Transform>
+void Trie<ValueType, Alphabet>::insertAll(const Trie& other, Transform transform)
+{
+    insertAllHelper(m_root, other.m_root, transform);
+}
+
+template<typename ValueType, typename Alphabet>
+template<typename Transform>
+void Trie<ValueType, Alphabet>::insertAllHelper(Node* dst, const Node* src, Transform& transform)
+{
+    // dst and src are the nodes for the same key in the two tries
+    for (int i = 0; i < src->m_values.size(); i++)
+        addValue(dst, transform(src->m_values[i]));
+    
+    // Account for what src had already dropped
+    dst->m_count += src->m_count - src->m_values.size();
+    dst->m_prefixCount += src->m_prefixCount;
+    
+    for (int i = 0; i < Alphabet::SIZE; i++)
+    {
+        if (src->m_children[i] == nullptr)
+            continue;
+        
+        if (dst->m_children[i] == nullptr)
+            dst->m_children[i] = new Node();
+        
+        insertAllHelper(dst->m_children[i], src->m_children[i], transform);
+    }
+}
+
+
+template<typename ValueType, typename Alphabet>
+std::vector<ValueType> Trie<ValueType, Alphabet>::find(const std::string& key, bool exactMatchOnly, bool prefix) const
 {
     vector<ValueType> temp;
+    find(key, exactMatchOnly, temp, prefix);
+    return temp;
+}
+
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::find(const std::string& key, bool exactMatchOnly, std::vector<ValueType>& values, bool prefix) const
+{
+    values.clear();
     
     if (key.size() == 0)
     {
         // Return whatever is stored in the first node in the Trie, the "" node
-        temp.insert(temp.end(), m_root->m_values.begin(), m_root->m_values.end());
-        return temp;
+        collectValues(m_root, prefix, values);
+        return;
     }
     
-    char firstChar = key[0];
+    Node* first = m_root->child(key[0]);
     
     // Key has not been stored in the Trie yet
-    if (m_root->m_children[firstChar] == nullptr)
-        return temp;
+    if (first == nullptr)
+        return;
     
     // We checked that the first character matched exactly to the search key
     // so now run our findHelper function, which permits up to one mismatched character
-    findHelper(key.substr(1), exactMatchOnly, m_root->m_children[firstChar], temp);
+    findHelper(key, 1, exactMatchOnly, prefix, first, values);
+}
+
+
+// Adds the values stored at t to v, and if prefix is true, the values
+// of all t's descendants too
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::collectValues(const Node* t, bool prefix, vector<ValueType>& v) const
+{
+    if (!truncated(t))
+        v.insert(v.end(), t->m_values.begin(), t->m_values.end());
     
-    return temp;
+    if (!prefix)
+        return;
+    
+    for (int i = 0; i < Alphabet::SIZE; i++)
+    {
+        if (t->m_children[i] != nullptr)
+            collectValues(t->m_children[i], true, v);
+    }
 }
 
 
-template<typename ValueType>
-void Trie<ValueType>::findHelper(const std::string& key, bool exactMatchOnly,
-                                                   Node* t, vector<ValueType>& v) const
+// Searches the part of key from position depth onward, starting at node t
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::findHelper(const std::string& key, int depth, bool exactMatchOnly, bool prefix,
+                                           Node* t, vector<ValueType>& v) const
 {
     if (t == nullptr)
     {
@@ -166,39 +472,130 @@ void Trie<ValueType>::findHelper(const std::string& key, bool exactMatchOnly,
         return;
     }
     
-    if (key.size() == 0)
+    if (depth == key.size())
     {
         // Found a Node that a valid key maps to, so store the node's values
         // in our vector temp
-        v.insert(v.end(), t->m_values.begin(), t->m_values.end());
+        collectValues(t, prefix, v);
         return;
     }
     
-    char firstChar = key[0];
+    int r = Alphabet::rank(key[depth]);
     
     if (exactMatchOnly)
     {
-        findHelper(key.substr(1), true, t->m_children[firstChar], v);
+        findHelper(key, depth + 1, true, prefix, t->child(key[depth]), v);
     }
     else
     {
         // We allow up to one mismatch. Recursively call findHelper(),
-        // traversing down the firstChar's path. Continue to allow up to one
+        // traversing down the current character's path. Continue to allow up to one
         // mismatch for that call
-        findHelper(key.substr(1), false, t->m_children[firstChar], v);
+        findHelper(key, depth + 1, false, prefix, t->child(key[depth]), v);
         
-        for (int i = 0; i < POSSIBLE_CHARACTERS; i++)
+        for (int i = 0; i < Alphabet::SIZE; i++)
         {
             // Recursively call findHelper for each character. If that path
             // continues, do not allow any more mismatches, because this was the
             // one permitted mismatch
-            if (i != firstChar)
+            if (i != r)
             {
-                findHelper(key.substr(1), true, t->m_children[i], v);
+                findHelper(key, depth + 1, true, prefix, t->m_children[i], v);
             }
         }
     }
 }
 
 
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::findBatch(const std::vector<std::string>& keys, bool exactMatchOnly,
+                                          std::vector<std::vector<ValueType>>& results, bool prefix) const
+{
+    results.clear();
+    results.resize(keys.size());
+    
+    deque<LookupState> pending;
+    int nextQuery = 0;
+    
+    while (nextQuery < keys.size() || !pending.empty())
+    {
+        // Keep the window full by starting new lookups as old ones finish.
+        // The first character must always match exactly, so a lookup
+        // starts at the root's child for that character
+        while (pending.size() < BATCH_LOOKUP_WINDOW && nextQuery < keys.size())
+        {
+            const string& key = keys[nextQuery];
+            if (key.size() == 0)
+                collectValues(m_root, prefix, results[nextQuery]);
+            else
+                queueLookup(pending, key, nextQuery, 1, exactMatchOnly, m_root->child(key[0]));
+            nextQuery++;
+        }
+        
+        if (pending.empty())
+            continue;
+        
+        // By the time a state reaches the front of the queue, the prefetch
+        // issued for its node has had the other lookups' work to hide behind
+        LookupState cur = pending.front();
+        pending.pop_front();
+        
+        const string& key = keys[cur.query];
+        
+        if (cur.depth == key.size())
+        {
+            vector<ValueType>& v = results[cur.query];
+            if (!truncated(cur.node))
+                v.insert(v.end(), cur.node->m_values.begin(), cur.node->m_values.end());
+            
+            // Every key below this node starts with a matching key
+            if (prefix)
+            {
+                for (int i = 0; i < Alphabet::SIZE; i++)
+                    queueLookup(pending, key, cur.query, cur.depth, true, cur.node->m_children[i]);
+            }
+            continue;
+        }
+        
+        char nextChar = key[cur.depth];
+        queueLookup(pending, key, cur.query, cur.depth + 1, cur.exactMatchOnly, cur.node->child(nextChar));
+        
+        if (!cur.exactMatchOnly)
+        {
+            // Same as findHelper(): every other child uses up the one
+            // permitted mismatch
+            int r = Alphabet::rank(nextChar);
+            for (int i = 0; i < Alphabet::SIZE; i++)
+            {
+                if (i != r)
+                    queueLookup(pending, key, cur.query, cur.depth + 1, true, cur.node->m_children[i]);
+            }
+        }
+    }
+}
+
+template<typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::queueLookup(deque<LookupState>& pending, const std::string& key, int query,
+                                            int depth, bool exactMatchOnly, Node* t) const
+{
+    // Search term is not present down this path
+    if (t == nullptr)
+        return;
+    
+    // Start pulling in the part of the node we will read next: the
+    // child slot for the next character, or the values if we are done
+    if (depth < key.size() && Alphabet::rank(key[depth]) >= 0)
+        TRIE_PREFETCH(&t->m_children[Alphabet::rank(key[depth])]);
+    else
+        TRIE_PREFETCH(&t->m_values);
+    
+    LookupState s;
+    s.query = query;
+    s.depth = depth;
+    s.exactMatchOnly = exactMatchOnly;
+    s.node = t;
+    pending.push_back(s);
+}
+
+
 #endif // TRIE_INCLUDED
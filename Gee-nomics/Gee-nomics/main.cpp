@@ -12,10 +12,47 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <map>
 #include <cctype>
 #include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#ifdef COUNT_ALLOCATIONS
+#include <atomic>
+#include <new>
+#endif
 using namespace std;
 
+#ifdef COUNT_ALLOCATIONS
+// Every allocation the program makes is counted, so the benchmark can
+// show how many a lookup costs. Counting slows every allocation, so it's
+// only built when COUNT_ALLOCATIONS is defined
+atomic<long long> allocations(0);
+
+// These are kept out of line. Inlined, the compiler sees malloc() and
+// free() paired with operator new and delete and warns of a mismatch
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    allocations++;
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+#endif
+
 // Change the string literal in this declaration to be the path to the
 // directory that contains the genome data files we provide, e.g.,
 // "Z:/CS32/Geenomics/data" or "/Users/fred/cs32/Geenomics/data"
@@ -44,8 +81,36 @@ void createNewLibrary(GenomeMatcher*& library)
         cout << "Invalid prefix size." << endl;
         return;
     }
+    IndexOptions options;
+    cout << "Enter maximum search length to index (" << len << "-100, blank for " << len << "): ";
+    getline(cin, line);
+    options.maxSearchLength = line.empty() ? len : atoi(line.c_str());
+    if (options.maxSearchLength < len || options.maxSearchLength > 100)
+    {
+        cout << "Invalid maximum search length." << endl;
+        return;
+    }
+    cout << "Enter maximum occurrences of a seed before it is treated as a repeat (0 for no limit): ";
+    getline(cin, line);
+    options.maxSeedOccurrences = atoi(line.c_str());
+    if (options.maxSeedOccurrences < 0)
+    {
+        cout << "Maximum occurrences must not be negative." << endl;
+        return;
+    }
+    cout << "Skip seeds containing N (y or n): ";
+    getline(cin, line);
+    options.skipAmbiguousSeeds = (!line.empty() && tolower(line[0]) == 'y');
+    cout << "Enter Bloom filter bits per base for related genome searches (0 for no filters): ";
+    getline(cin, line);
+    options.filterBitsPerSeed = atoi(line.c_str());
+    if (options.filterBitsPerSeed < 0)
+    {
+        cout << "Bits per base must not be negative." << endl;
+        return;
+    }
     delete library;
-    library = new GenomeMatcher(len);
+    library = new GenomeMatcher(len, options);
 }
 
 void addOneGenomeManually(GenomeMatcher* library)
@@ -71,20 +136,26 @@ void addOneGenomeManually(GenomeMatcher* library)
         cout << "Invalid character in DNA sequence." << endl;
         return;
     }
-    for (char ch : sequence)
+    for (char& ch : sequence)
         ch = toupper(ch);
     library->addGenome(Genome(name, sequence));
 }
 
 bool loadFile(string filename, vector<Genome>& genomes)
 {
-    ifstream inputf(filename);
+    GenomeFile inputf(filename);
     if (!inputf)
     {
         cout << "Cannot open file: " << filename << endl;
         return false;
     }
-    if (!Genome::load(inputf, genomes))
+    bool loaded = Genome::load(inputf, genomes);
+    if (inputf.bad())
+    {
+        cout << "Cannot read file: " << filename << endl;
+        return false;
+    }
+    if (!loaded)
     {
         cout << "Improperly formatted file: " << filename << endl;
         return false;
@@ -110,18 +181,85 @@ void loadOneDataFile(GenomeMatcher* library)
     cout << "Successfully loaded " << genomes.size() << " genomes." << endl;
 }
 
+void loadOneDataFileOnDisk(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter file name: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    GenomeFile inputf(filename);
+    if (!inputf)
+    {
+        cout << "Cannot open file: " << filename << endl;
+        return;
+    }
+    ExternalBuildOptions options;
+    cout << "Enter index file name (blank for " << options.indexPath << "): ";
+    string line;
+    getline(cin, line);
+    if (!line.empty())
+        options.indexPath = line;
+    cout << "Enter memory budget in MB (blank for " << options.memoryBudget / (1 << 20) << "): ";
+    getline(cin, line);
+    if (!line.empty())
+        options.memoryBudget = atoll(line.c_str()) * (1 << 20);
+    if (options.memoryBudget <= 0)
+    {
+        cout << "Memory budget must be positive." << endl;
+        return;
+    }
+    
+    // Report each time another run is spilled or another tenth merged
+    int lastRuns = 0;
+    long long lastTenth = 0;
+    options.progress = [&](const BuildProgress& p)
+    {
+        long long tenth = p.seedsWritten > 0 ? p.seedsMerged * 10 / p.seedsWritten : 0;
+        if (p.runsWritten == lastRuns && tenth == lastTenth)
+            return;
+        cout << "  " << p.genomesRead << " genomes, " << p.basesRead << " bases read, "
+             << p.runsWritten << " runs written, " << p.seedsMerged << " of " << p.seedsWritten << " seeds merged" << endl;
+        lastRuns = p.runsWritten;
+        lastTenth = tenth;
+    };
+    
+    if (!library->addGenomesFromFile(inputf, options))
+    {
+        cout << "Could not load " << filename << " (improperly formatted, or the index file exists or can't be written)" << endl;
+        return;
+    }
+    cout << "Successfully loaded " << filename << endl;
+}
+
 void loadProvidedFiles(GenomeMatcher* library)
 {
+    vector<string> filenames;
     for (const string& f : providedFiles)
+        filenames.push_back(PROVIDED_DIR + "/" + f);
+    
+    // The files are read and indexed all at once, but reported in order
+    FileLoadOptions options;
+    options.fileDone = [](const FileLoadResult& result)
     {
-        vector<Genome> genomes;
-        if (loadFile(PROVIDED_DIR + "/" + f, genomes))
-        {
-            for (const auto& g : genomes)
-                library->addGenome(g);
-            cout << "Loaded " << genomes.size() << " genomes from " << f << endl;
-        }
-    }
+        if (result.status == FileLoadStatus::CannotOpen)
+            cout << "Cannot open file: " << result.filename << endl;
+        else if (result.status == FileLoadStatus::CannotRead)
+            cout << "Cannot read file: " << result.filename << endl;
+        else if (result.status == FileLoadStatus::ImproperlyFormatted)
+            cout << "Improperly formatted file: " << result.filename << endl;
+        else
+            cout << "Loaded " << result.genomesAdded << " genomes from "
+                 << result.filename.substr(PROVIDED_DIR.size() + 1) << endl;
+    };
+    vector<FileLoadResult> results;
+    auto start = chrono::steady_clock::now();
+    library->addGenomesFromFiles(filenames, options, results);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "  Done in " << seconds << "s" << endl;
 }
 
 void findGenome(GenomeMatcher* library, bool exactMatch)
@@ -257,6 +395,451 @@ void findRelatedGenomesFromFile(GenomeMatcher* library)
     }
 }
 
+void findRelatedGenomesWithDeadline(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter name of file containing one or more genomes to find matches for: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    vector<Genome> genomes;
+    if (!loadFile(filename, genomes))
+        return;
+    double pctThreshold;
+    bool exactMatchOnly;
+    if (!getFindRelatedParams(pctThreshold, exactMatchOnly))
+        return;
+    cout << "Enter deadline for each genome in milliseconds: ";
+    string line;
+    getline(cin, line);
+    int deadlineMs = atoi(line.c_str());
+    if (deadlineMs <= 0)
+    {
+        cout << "Deadline must be positive." << endl;
+        return;
+    }
+    
+    // Start every search at once, each with its own deadline
+    int minLength = library->minimumSearchLength();
+    vector<future<RelatedGenomesResult>> searches;
+    for (const auto& g : genomes)
+    {
+        QueryOptions options;
+        options.deadline = chrono::steady_clock::now() + chrono::milliseconds(deadlineMs);
+        searches.push_back(library->findRelatedGenomesAsync(g, 2 * minLength, exactMatchOnly, pctThreshold, options));
+    }
+    
+    for (int i = 0; i < genomes.size(); i++)
+    {
+        RelatedGenomesResult result = searches[i].get();
+        cout << "  For " << genomes[i].name() << endl;
+        if (result.status != QueryStatus::Completed)
+        {
+            cout << "    Gave up: " << (result.status == QueryStatus::Cancelled ? "cancelled" : "deadline passed") << endl;
+            continue;
+        }
+        if (result.results.empty())
+        {
+            cout << "    No related genomes were found" << endl;
+            continue;
+        }
+        cout << "    " << result.results.size() << " related genomes were found:" << endl;
+        cout.setf(ios::fixed);
+        cout.precision(2);
+        for (const auto& m : result.results)
+            cout << "     " << setw(6) << m.percentMatch << "%  " << m.genomeName << endl;
+    }
+}
+
+void findTopRelatedGenomes(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter name of file containing one or more genomes to find matches for: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    vector<Genome> genomes;
+    if (!loadFile(filename, genomes))
+        return;
+    double pctThreshold;
+    bool exactMatchOnly;
+    if (!getFindRelatedParams(pctThreshold, exactMatchOnly))
+        return;
+    RelatedGenomesOptions options;
+    cout << "Enter number of genomes to return (0 for all): ";
+    string line;
+    getline(cin, line);
+    options.maxResults = atoi(line.c_str());
+    cout << "Enter confidence to stop early at, e.g. 0.99 (0 to look up every fragment): ";
+    getline(cin, line);
+    options.confidence = atof(line.c_str());
+    if (options.maxResults < 0 || options.confidence < 0 || options.confidence >= 1)
+    {
+        cout << "Number must not be negative, and confidence must be at least 0 and less than 1." << endl;
+        return;
+    }
+    if (options.confidence == 0)
+    {
+        cout << "Score windows at every offset (y/n): ";
+        getline(cin, line);
+        options.slidingWindows = !line.empty() && tolower(line[0]) == 'y';
+    }
+    
+    // Time each search both ways, to show what stopping early saves
+    int minLength = library->minimumSearchLength();
+    for (const auto& g : genomes)
+    {
+        vector<GenomeMatch> matches;
+        auto start = chrono::steady_clock::now();
+        library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, pctThreshold, matches);
+        double fullSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, pctThreshold, options, matches);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        cout << "  For " << g.name() << " (" << seconds << "s, " << fullSeconds << "s for a full search)" << endl;
+        if (matches.empty())
+        {
+            cout << "    No related genomes were found" << endl;
+            continue;
+        }
+        cout << "    " << matches.size() << " related genomes were found:" << endl;
+        cout.setf(ios::fixed);
+        cout.precision(2);
+        for (const auto& m : matches)
+            cout << "     " << setw(6) << m.percentMatch << "%  " << m.genomeName << endl;
+        cout.unsetf(ios::fixed);
+        cout.precision(6);
+    }
+}
+
+// Checks the sliding window scores of each genome in a file against
+// looking up every window of it on its own
+void checkSlidingWindows(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter name of file containing one or more genomes to check: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    vector<Genome> genomes;
+    if (!loadFile(filename, genomes))
+        return;
+    cout << "Require (e)xact match or allow (S)NiPs (e or s): ";
+    string line;
+    getline(cin, line);
+    if (line.empty() || (line[0] != 'e' && line[0] != 's'))
+    {
+        cout << "Response must be e or s." << endl;
+        return;
+    }
+    bool exactMatchOnly = (line[0] == 'e');
+    
+    int fragmentLength = 2 * library->minimumSearchLength();
+    RelatedGenomesOptions options;
+    options.slidingWindows = true;
+    int disagreeing = 0;
+    for (const auto& g : genomes)
+    {
+        long long numWindows = g.length() - fragmentLength + 1;
+        if (numWindows <= 0)
+            continue;
+        
+        // Genomes of the library with no window found are left out
+        map<string, long long> windowsFound;
+        vector<string> windows;
+        vector<vector<DNAMatch>> matches;
+        for (long long start = 0; start < numWindows; start += windows.size())
+        {
+            windows.resize(min<long long>(1024, numWindows - start));
+            for (int w = 0; w < windows.size(); w++)
+                g.extract(start + w, fragmentLength, windows[w]);
+            library->findGenomesWithThisDNA(windows, fragmentLength, exactMatchOnly, matches);
+            for (const auto& windowMatches : matches)
+            {
+                for (const auto& m : windowMatches)
+                    windowsFound[m.genomeName]++;
+            }
+        }
+        
+        vector<GenomeMatch> results;
+        library->findRelatedGenomes(g, fragmentLength, exactMatchOnly, 0, options, results);
+        int wrong = results.size() != windowsFound.size();
+        for (const auto& r : results)
+        {
+            if (!windowsFound.count(r.genomeName) ||
+                abs(r.percentMatch - windowsFound[r.genomeName] * 100.0 / numWindows) > 1e-9)
+                wrong++;
+        }
+        if (wrong > 0)
+        {
+            cout << "  " << g.name() << " scores differ from looking up every window" << endl;
+            disagreeing++;
+        }
+    }
+    cout << "  " << genomes.size() - disagreeing << " of " << genomes.size() << " genomes agree" << endl;
+}
+
+void findMaximalMatchesFromFile(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter name of file containing one or more genomes to find matches for: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    vector<Genome> genomes;
+    if (!loadFile(filename, genomes))
+        return;
+    cout << "Enter minimum match length: ";
+    string line;
+    getline(cin, line);
+    int minLength = atoi(line.c_str());
+    if (minLength < library->minimumSearchLength())
+    {
+        cout << "Minimum match length must be at least " << library->minimumSearchLength() << endl;
+        return;
+    }
+    
+    // Long queries can have thousands of matches, so only the longest are shown
+    const int MATCHES_SHOWN = 20;
+    for (const auto& g : genomes)
+    {
+        vector<MaximalMatch> matches;
+        auto start = chrono::steady_clock::now();
+        library->findMaximalMatches(g, minLength, matches);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        cout << "  For " << g.name() << " (" << seconds << "s)" << endl;
+        if (matches.empty())
+        {
+            cout << "    No maximal matches were found" << endl;
+            continue;
+        }
+        long long covered = 0;
+        for (const auto& m : matches)
+            covered += m.length;
+        cout << "    " << matches.size() << " maximal matches were found, " << covered << " bases in all" << endl;
+        stable_sort(matches.begin(), matches.end(), [](const MaximalMatch& a, const MaximalMatch& b) { return a.length > b.length; });
+        for (int i = 0; i < matches.size() && i < MATCHES_SHOWN; i++)
+        {
+            const MaximalMatch& m = matches[i];
+            cout << "     length " << setw(8) << m.length << "  query " << setw(10) << m.queryPosition
+                 << "  position " << setw(10) << m.genomePosition << " in " << m.genomeName << endl;
+        }
+    }
+}
+
+void writeSimilarityMatrix(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter name of file to write the matrix to: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    cout << "Require (e)xact match or allow (S)NiPs (e or s): ";
+    string line;
+    getline(cin, line);
+    if (line.empty() || (line[0] != 'e' && line[0] != 's'))
+    {
+        cout << "Response must be e or s." << endl;
+        return;
+    }
+    bool exactMatchOnly = (line[0] == 'e');
+    
+    ofstream matrix(filename);
+    matrix.setf(ios::fixed);
+    matrix.precision(2);
+    auto start = chrono::steady_clock::now();
+    if (!library->computeSimilarityMatrix(2 * library->minimumSearchLength(), exactMatchOnly, matrix))
+    {
+        cout << "Cannot write " << filename << endl;
+        return;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "  Matrix written to " << filename << " in " << seconds << "s" << endl;
+}
+
+void benchmarkLookups(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter name of file containing genomes to sample fragments from: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    vector<Genome> genomes;
+    if (!loadFile(filename, genomes))
+        return;
+    cout << "Enter number of fragments to look up: ";
+    string line;
+    getline(cin, line);
+    int count = atoi(line.c_str());
+    if (count <= 0)
+    {
+        cout << "Number of fragments must be positive." << endl;
+        return;
+    }
+    
+    int fragmentLength = 2 * library->minimumSearchLength();
+    vector<string> fragments;
+    srand(1);
+    for (int i = 0; fragments.size() < count && i < 100 * count; i++)
+    {
+        const Genome& g = genomes[rand() % genomes.size()];
+        if (g.length() < fragmentLength)
+            continue;
+        string fragment;
+        if (g.extract(rand() % (g.length() - fragmentLength + 1), fragmentLength, fragment))
+            fragments.push_back(fragment);
+    }
+    if (fragments.empty())
+    {
+        cout << "No genome is long enough to sample fragments of length " << fragmentLength << endl;
+        return;
+    }
+    
+    for (int exact = 1; exact >= 0; exact--)
+    {
+        vector<double> latencies;
+        auto start = chrono::steady_clock::now();
+        vector<DNAMatch> matches;
+        for (const auto& f : fragments)
+        {
+            auto queryStart = chrono::steady_clock::now();
+            library->findGenomesWithThisDNA(f, fragmentLength, exact, matches);
+            latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - queryStart).count());
+        }
+        double oneAtATime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        sort(latencies.begin(), latencies.end());
+        
+        start = chrono::steady_clock::now();
+        vector<vector<DNAMatch>> batchMatches;
+        library->findGenomesWithThisDNA(fragments, fragmentLength, exact, batchMatches);
+        double batched = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        // The first pass grows the context's buffers. The second should
+        // allocate nothing
+        QueryContext context;
+        for (const auto& f : fragments)
+            library->findGenomesWithThisDNA(f, fragmentLength, exact, context);
+#ifdef COUNT_ALLOCATIONS
+        long long allocationsBefore = allocations;
+#endif
+        start = chrono::steady_clock::now();
+        for (const auto& f : fragments)
+            library->findGenomesWithThisDNA(f, fragmentLength, exact, context);
+        double withContext = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+#ifdef COUNT_ALLOCATIONS
+        long long contextAllocations = allocations - allocationsBefore;
+#endif
+        
+        cout.setf(ios::fixed);
+        cout.precision(0);
+        cout << (exact ? "  Exact:" : "  SNiPs:")
+             << " one at a time " << fragments.size() / oneAtATime << " lookups/sec,"
+             << " batched " << fragments.size() / batched << " lookups/sec" << endl;
+        cout << "         with a context " << fragments.size() / withContext << " lookups/sec";
+#ifdef COUNT_ALLOCATIONS
+        cout << ", " << contextAllocations << " allocations in " << fragments.size() << " lookups";
+#endif
+        cout << endl;
+        cout << "         latency p50 " << latencies[latencies.size() / 2] << "us,"
+             << " p99 " << latencies[latencies.size() * 99 / 100] << "us,"
+             << " max " << latencies.back() << "us" << endl;
+        cout.unsetf(ios::fixed);
+        cout.precision(6);
+    }
+}
+
+void changeMinimumSearchLength(GenomeMatcher* library)
+{
+    cout << "Enter minimum search length (1-" << library->maximumSearchLength() << "): ";
+    string line;
+    getline(cin, line);
+    if (!library->setMinimumSearchLength(atoi(line.c_str())))
+    {
+        cout << "Invalid minimum search length." << endl;
+        return;
+    }
+    cout << "Minimum search length is now " << library->minimumSearchLength() << endl;
+}
+
+void showIndexStatistics(GenomeMatcher* library)
+{
+    IndexStatistics stats;
+    library->indexStatistics(stats);
+    cout << "  Seeds indexed:                  " << stats.seedsIndexed << endl;
+    cout << "  Distinct seeds:                 " << stats.distinctSeeds << endl;
+    cout << "  Seeds skipped for N:            " << stats.ambiguousSeedsSkipped << endl;
+    cout << "  Repeat seeds over the cap:      " << stats.overRepresentedSeeds << endl;
+    cout << "  Postings dropped for repeats:   " << stats.postingsDropped << endl;
+    cout << "  Worst-case extensions per lookup without cap: " << stats.mostOccurrences << endl;
+    cout << "  Worst-case extensions per lookup with cap:    " << stats.longestPostingList << endl;
+}
+
+void countKmers(GenomeMatcher* library)
+{
+    cout << "Enter k (1-32): ";
+    string line;
+    getline(cin, line);
+    int k = atoi(line.c_str());
+    cout << "Count k-mers shared between genomes too (y/n): ";
+    getline(cin, line);
+    bool sharedCounts = !line.empty() && tolower(line[0]) == 'y';
+    
+    KmerCounts counts;
+    auto start = chrono::steady_clock::now();
+    if (!library->countKmers(k, sharedCounts, counts))
+    {
+        cout << "Invalid k." << endl;
+        return;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    cout << "  Counted in " << seconds << "s" << endl;
+    cout << "  " << k << "-mers counted:         " << counts.totalKmers << endl;
+    cout << "  Distinct " << k << "-mers:        " << counts.distinctKmers << endl;
+    cout << "  Windows skipped for N:  " << counts.ambiguousKmersSkipped << endl;
+    
+    // The spectrum can be long, so show only its low end
+    const int SPECTRUM_SHOWN = 20;
+    cout << "  Spectrum (occurrences: distinct " << k << "-mers):" << endl;
+    for (int i = 0; i < counts.spectrum.size() && i < SPECTRUM_SHOWN; i++)
+        cout << "    " << setw(8) << counts.spectrum[i].occurrences << ": " << counts.spectrum[i].distinctKmers << endl;
+    if (counts.spectrum.size() > SPECTRUM_SHOWN)
+        cout << "    ... up to " << counts.spectrum.back().occurrences << endl;
+    
+    for (int g = 0; g < counts.genomes.size(); g++)
+    {
+        const GenomeKmerCounts& genome = counts.genomes[g];
+        cout << "  " << genome.genomeName << endl;
+        cout << "    " << genome.kmers << " counted, " << genome.distinctKmers << " distinct, "
+             << genome.uniqueKmers << " in no other genome" << endl;
+        for (int h = 0; h < counts.shared.size(); h++)
+        {
+            if (h != g && counts.shared[g][h] > 0)
+                cout << "    " << setw(12) << counts.shared[g][h] << " shared with " << counts.genomes[h].genomeName << endl;
+        }
+    }
+}
+
 void showMenu()
 {
     cout << "        Commands:" << endl;
@@ -265,6 +848,12 @@ void showMenu()
     cout << "         l - load one data file             f - find related genomes (file)" << endl;
     cout << "         d - load all provided data files   ? - show this menu" << endl;
     cout << "         e - find matches exactly           q - quit" << endl;
+    cout << "         b - benchmark lookups              i - show index statistics" << endl;
+    cout << "         k - change minimum search length   o - load one data file, index on disk" << endl;
+    cout << "         w - find related genomes (file) with a deadline" << endl;
+    cout << "         m - count k-mers                   t - find top related genomes (file)" << endl;
+    cout << "         x - find maximal exact matches (file)  v - write similarity matrix of all genomes" << endl;
+    cout << "         g - check sliding window scores against every window (file)" << endl;
 }
 
 int main()
@@ -320,6 +909,36 @@ int main()
             case 'f':
                 findRelatedGenomesFromFile(library);
                 break;
+            case 'b':
+                benchmarkLookups(library);
+                break;
+            case 'i':
+                showIndexStatistics(library);
+                break;
+            case 'k':
+                changeMinimumSearchLength(library);
+                break;
+            case 'o':
+                loadOneDataFileOnDisk(library);
+                break;
+            case 'w':
+                findRelatedGenomesWithDeadline(library);
+                break;
+            case 'm':
+                countKmers(library);
+                break;
+            case 't':
+                findTopRelatedGenomes(library);
+                break;
+            case 'x':
+                findMaximalMatchesFromFile(library);
+                break;
+            case 'v':
+                writeSimilarityMatrix(library);
+                break;
+            case 'g':
+                checkSlidingWindows(library);
+                break;
         }
     }
 }
@@ -4,6 +4,12 @@
 #include <string>
 #include <vector>
 #include <istream>
+#include <ostream>
+#include <functional>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <atomic>
 
 class GenomeImpl;
 
@@ -15,19 +21,50 @@ public:
     Genome(const Genome& other);
     Genome& operator=(const Genome& rhs);
     static bool load(std::istream& genomeSource, std::vector<Genome>& genomes);
-    int length() const;
+    long long length() const;
     std::string name() const;
-    bool extract(int position, int length, std::string& fragment) const;
+    bool extract(long long position, long long length, std::string& fragment) const;
     
 private:
     GenomeImpl* m_impl;
 };
 
+class GenomeFileImpl;
+
+// A genome file opened for reading, to give to Genome::load or to
+// GenomeMatcher::addGenomesFromFile. A gzip compressed file is
+// decompressed as it is read, whatever its name. A BGZF file, as bgzip
+// writes, is made of blocks compressed on their own, and blocks ahead of
+// the reader are decompressed on decompressThreads threads at once.
+// Anything else is read as it is. As with an ifstream, the stream fails
+// at once if the file can't be opened. If the file can't be read to the
+// end, or its compressed data is corrupt, bad() is set where it stops
+class GenomeFile : public std::istream
+{
+public:
+    // 0 decompressThreads means one per core
+    explicit GenomeFile(const std::string& filename, int decompressThreads = 0);
+    ~GenomeFile();
+    GenomeFile(const GenomeFile&) = delete;
+    GenomeFile& operator=(const GenomeFile&) = delete;
+private:
+    GenomeFileImpl* m_impl;
+};
+
 struct DNAMatch
 {
     std::string genomeName;
     int length;
-    int position;
+    long long position;
+};
+
+// A match found through a QueryContext. Rather than a copy of the
+// genome's name, it points at the library's own
+struct DNAMatchRef
+{
+    const std::string* genomeName;
+    int length;
+    long long position;
 };
 
 struct GenomeMatch
@@ -36,21 +73,337 @@ struct GenomeMatch
     double percentMatch;
 };
 
+// A maximal exact match: queryPosition and genomePosition start length
+// bases that are the same in the query and the genome, and are preceded
+// and followed by bases that differ, or by the end of either
+struct MaximalMatch
+{
+    std::string genomeName;
+    long long queryPosition;
+    long long genomePosition;
+    long long length;
+};
+
+// Controls which seeds (windows of minSearchLength bases) a
+// GenomeMatcher indexes and searches with
+struct IndexOptions
+{
+    IndexOptions();
+    // Seeds are indexed to this length, so the minimum search length can
+    // later be changed to anything up to it without rebuilding the index.
+    // Each extra base of depth costs memory. 0 means minSearchLength
+    int maxSearchLength;
+    // Seeds occurring more often than this in the library are repeats.
+    // A fragment whose first seed is a repeat is looked up by a later
+    // seed instead. That still finds it where any one base but its first
+    // differs, unless the genome's own seed there is a repeat. 0 means
+    // no limit
+    int maxSeedOccurrences;
+    // Don't index seeds containing N, and look fragments up by a seed
+    // without N, as for a repeat
+    bool skipAmbiguousSeeds;
+    // Each genome gets a Bloom filter of its seeds, this many bits per
+    // base, which findRelatedGenomes uses to skip genomes that share too
+    // few seeds with the query to be related. This pays when seeds are
+    // long enough that a genome holds few of all possible seeds. With a
+    // mismatch allowed, every seed is probed in about 4 * minSearchLength
+    // forms, so more bits (16 or so) are needed to keep false positives
+    // from adding up. 0, the default, means no filters
+    int filterBitsPerSeed;
+};
+
+struct IndexStatistics
+{
+    IndexStatistics();
+    long long seedsIndexed;             // windows indexed, over all genomes
+    long long distinctSeeds;
+    long long ambiguousSeedsSkipped;    // windows not indexed because of N
+    long long overRepresentedSeeds;     // distinct seeds over maxSeedOccurrences
+    long long postingsDropped;          // occurrences of those seeds not stored
+    long long mostOccurrences;          // most occurrences of any one seed
+    long long longestPostingList;       // most occurrences of a seed still searched
+};
+
+// How many distinct k-mers occur a given number of times in the library
+struct KmerFrequency
+{
+    long long   occurrences;
+    long long   distinctKmers;
+};
+
+struct GenomeKmerCounts
+{
+    std::string genomeName;
+    long long   kmers;              // windows of k bases counted
+    long long   distinctKmers;
+    long long   uniqueKmers;        // distinct k-mers no other genome holds
+};
+
+// What GenomeMatcher::countKmers finds. k-mers are read off each genome
+// as it is stored, not its reverse complement, and windows with N are
+// not counted
+struct KmerCounts
+{
+    KmerCounts();
+    int                                     k;
+    long long                               totalKmers;             // windows counted, over all genomes
+    long long                               ambiguousKmersSkipped;  // windows not counted because of N
+    long long                               distinctKmers;
+    std::vector<KmerFrequency>              spectrum;               // by occurrences, leaving out those no k-mer has
+    std::vector<GenomeKmerCounts>           genomes;                // in the order the genomes were added
+    // shared[i][j] is the number of distinct k-mers genomes i and j both
+    // hold, so shared[i][i] is genome i's distinctKmers. Empty unless asked for
+    std::vector<std::vector<long long>>     shared;
+};
+
+// Lets findRelatedGenomes return fewer genomes, and stop before it has
+// looked up every fragment of the query once the answer is clear
+struct RelatedGenomesOptions
+{
+    RelatedGenomesOptions();
+    // Return only this many of the best matching genomes over the
+    // threshold. 0, the default, means all of them
+    int maxResults;
+    // If between 0 and 1, fragments are looked up in a random order, and
+    // the search stops as soon as, with this confidence, it knows which
+    // genomes are over the threshold (or, with maxResults, which are the
+    // best that many). percentMatch is then estimated from the fragments
+    // looked up so far. 0, the default, means look up every fragment
+    double confidence;
+    // Seeds the random order, so that a search can be repeated exactly
+    unsigned int randomSeed;
+    // If true, every window of fragmentMatchLength bases of the query, at
+    // every offset, is looked for rather than only the fragments starting
+    // at multiples of fragmentMatchLength. percentMatch is then the
+    // percentage of windows found in the genome, which doesn't depend on
+    // where the query happens to start. Costs little more than looking
+    // up the fragments. Can't be combined with confidence. Windows with
+    // N are found just as looking each window up on its own finds them.
+    // Allowing SNiPs, though, where a window's seeds are skipped (for N
+    // with skipAmbiguousSeeds, or as repeats) it may be found through a
+    // different seed than the lookup of it alone would use, which can
+    // tolerate a SNiP that lookup wouldn't, or the other way around
+    bool slidingWindows;
+};
+
+// How far GenomeMatcher::addGenomesFromFile has got. Seeds are first
+// spilled to sorted runs as genomes are read, then merged into the index
+struct BuildProgress
+{
+    BuildProgress();
+    int         genomesRead;
+    long long   basesRead;
+    long long   seedsWritten;       // to runs, so far
+    int         runsWritten;
+    long long   seedsMerged;        // into the index, out of seedsWritten
+};
+
+// Controls how GenomeMatcher::addGenomesFromFile builds its index
+struct ExternalBuildOptions
+{
+    ExternalBuildOptions();
+    // Where the index is written. The runs are spilled alongside it, to
+    // indexPath with ".run0", ".run1" and so on appended. The file is the
+    // GenomeMatcher's until it is destroyed, and then removed
+    std::string indexPath;
+    // Bytes of seeds held in memory before they are spilled as a run
+    long long memoryBudget;
+    // Called every so often, if set, on the thread doing the build
+    std::function<void(const BuildProgress&)> progress;
+};
+
+// What became of one of the files given to GenomeMatcher::addGenomesFromFiles
+enum class FileLoadStatus
+{
+    Loaded,
+    CannotOpen,
+    CannotRead,             // the file or its compression is damaged
+    ImproperlyFormatted     // in either case none of the file's genomes are added
+};
+
+struct FileLoadResult
+{
+    FileLoadResult();
+    std::string     filename;
+    FileLoadStatus  status;
+    int             genomesAdded;
+    long long       basesAdded;
+};
+
+// Controls how GenomeMatcher::addGenomesFromFiles shares out its work.
+// Files are read and parsed on readerThreads threads, several at once,
+// and each genome is indexed on one of indexThreads threads as soon as
+// it is parsed. At most maxQueuedGenomes parsed genomes wait to be
+// indexed, so reading can't run far ahead of indexing
+struct FileLoadOptions
+{
+    FileLoadOptions();
+    int readerThreads;          // 2 by default
+    int indexThreads;           // 0, the default, means one per core
+    int maxQueuedGenomes;       // 16 by default
+    // Called, if set, for each file once its genomes are added or it is
+    // given up on, in the order of the files, one call at a time
+    std::function<void(const FileLoadResult&)> fileDone;
+};
+
+// Lets whoever starts an asynchronous search make it give up. Copies
+// share one flag, so a search can be cancelled through any of them
+class Cancellation
+{
+public:
+    Cancellation();
+    void cancel();
+    bool cancelled() const;
+private:
+    std::shared_ptr<std::atomic<bool>> m_flag;
+};
+
+// Limits on an asynchronous search. A search checks them as it goes,
+// between fragments and between the places a fragment is extended, and
+// gives up as soon as it is cancelled or its deadline passes. A search
+// whose deadline has passed before it gets to run is not run at all
+struct QueryOptions
+{
+    QueryOptions();
+    std::chrono::steady_clock::time_point deadline;     // time_point::max() for none
+    Cancellation cancellation;
+};
+
+enum class QueryStatus
+{
+    Completed,
+    Cancelled,
+    DeadlineExceeded
+};
+
+// What an asynchronous search produces. Unless status is Completed, the
+// search gave up part way and found is false and the vector empty.
+// Otherwise they are what the blocking form would have returned and set
+struct DNASearchResult
+{
+    QueryStatus             status;
+    bool                    found;
+    std::vector<DNAMatch>   matches;
+};
+
+struct RelatedGenomesResult
+{
+    QueryStatus                 status;
+    bool                        found;
+    std::vector<GenomeMatch>    results;
+};
+
+class QueryContextImpl;
+
+// Memory for a thread to reuse from one search to the next. Once its
+// buffers have grown to fit the searches made with it, a search made
+// with a QueryContext allocates no memory at all, except on a library
+// with genomes added by addGenomesFromFile. A QueryContext may only be
+// used by one thread at a time. It keeps the library as it was at its
+// last search alive until its next search or until it is destroyed
+class QueryContext
+{
+public:
+    QueryContext();
+    ~QueryContext();
+    // The matches of the last search made with this context, ordered
+    // the way the genomes were added. Their names are good until the
+    // next search with this context, or until it is destroyed
+    const std::vector<DNAMatchRef>& matches() const;
+    QueryContext(const QueryContext&) = delete;
+    QueryContext& operator=(const QueryContext&) = delete;
+private:
+    friend class GenomeMatcherImpl;
+    QueryContextImpl* m_impl;
+};
+
 class GenomeMatcherImpl;
 
+// All member functions may be called from several threads at once.
+// Searches run against the library as it was when they started and
+// are never blocked by addGenome, which may run at the same time
 class GenomeMatcher
 {
 public:
     GenomeMatcher(int minSearchLength);
+    GenomeMatcher(int minSearchLength, const IndexOptions& options);
     ~GenomeMatcher();
     void addGenome(const Genome& genome);
+    // Adds every genome in genomeSource, which is in the format
+    // Genome::load reads, indexing them on disk rather than in memory so
+    // the index can be larger than RAM. The genomes' DNA is still kept in
+    // memory. Returns false, adding nothing, if the source is not
+    // properly formatted or goes bad, there is already a file at
+    // options.indexPath or at one of the paths its runs are spilled to,
+    // or the index can't be written
+    bool addGenomesFromFile(std::istream& genomeSource, const ExternalBuildOptions& options);
+    // Adds the genomes of every file in filenames, which are in the format
+    // Genome::load reads and are opened as GenomeFiles, so may be gzip
+    // compressed. The files are read, parsed and indexed all at once. The
+    // genomes are added in the order of the files, and within a file in
+    // the order they are in it, just as loading each file in turn and
+    // adding its genomes would. A file that can't be opened or read, or
+    // isn't properly formatted, adds nothing. results[i] is what became
+    // of filenames[i]. Returns true if every file was loaded
+    bool addGenomesFromFiles(const std::vector<std::string>& filenames, const FileLoadOptions& options, std::vector<FileLoadResult>& results);
     int minimumSearchLength() const;
+    int maximumSearchLength() const;
+    // Changes the length of the seeds searches look up, without rebuilding
+    // the index. Returns false, changing nothing, unless
+    // 1 <= minSearchLength <= maximumSearchLength()
+    bool setMinimumSearchLength(int minSearchLength);
+    // A lookup extends every occurrence of its seed, so the longest posting
+    // list searched bounds the worst-case cost of one lookup
+    void indexStatistics(IndexStatistics& stats) const;
+    // Counts every k-mer of the library on all cores, for 1 <= k <= 32,
+    // whatever the search lengths. Counting takes about 16 bytes of memory
+    // per base of the library while it runs, and the shared counts another
+    // numGenomes * numGenomes per core. Returns false unless k is in range
+    bool countKmers(int k, bool sharedCounts, KmerCounts& counts) const;
     bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches) const;
+    // Same search, leaving the matches in context.matches() instead
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, QueryContext& context) const;
     bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold,
+                            const RelatedGenomesOptions& options, std::vector<GenomeMatch>& results) const;
+    // Asynchronous forms of the two searches above. They return at once,
+    // and the search runs on one of the GenomeMatcher's own threads,
+    // against the library as it is when the search starts. Destroying
+    // the GenomeMatcher waits for searches already started to finish
+    std::future<DNASearchResult> findGenomesWithThisDNAAsync(const std::string& fragment, int minimumLength, bool exactMatchOnly,
+                                                             const QueryOptions& options = QueryOptions()) const;
+    std::future<RelatedGenomesResult> findRelatedGenomesAsync(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold,
+                                                              const QueryOptions& options = QueryOptions()) const;
+    // Batched forms of the two blocking searches above. matches[i] (results[i]) is
+    // what the single form would produce for fragments[i] (queries[i]).
+    // The lookups of all the fragments overlap, so these are much faster
+    // than calling the single forms in a loop. Return true if anything matched
+    bool findGenomesWithThisDNA(const std::vector<std::string>& fragments, int minimumLength, bool exactMatchOnly, std::vector<std::vector<DNAMatch>>& matches) const;
+    bool findRelatedGenomes(const std::vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<std::vector<GenomeMatch>>& results) const;
+    // Finds every maximal exact match of at least minimumLength bases
+    // between query, anywhere in it, and the genomes of the library, in
+    // one pass over the query. N matches nothing. Matches are ordered by
+    // query position, then by genome in the order they were added, then
+    // by genome position. Returns false, leaving matches empty, if there
+    // are none or minimumLength is less than the minimum search length.
+    // Matches are found through the index's seeds, so with the
+    // IndexOptions maxSeedOccurrences set, a match all of whose seeds are
+    // repeats is left out: the index doesn't keep where repeats occur.
+    // Such matches lie wholly within repetitive, low-complexity DNA
+    bool findMaximalMatches(const Genome& query, int minimumLength, std::vector<MaximalMatch>& matches) const;
+    // Writes to output, tab separated, the percentMatch findRelatedGenomes
+    // would give every genome of the library for every genome of the
+    // library as the query: a header line of genome names, then a row
+    // for each query genome, its name then a column for each genome.
+    // The work is shared out over all cores. Rows are written in library
+    // order as soon as they are done, so the matrix is never held whole.
+    // Returns false if fragmentMatchLength is less than the minimum search
+    // length or output fails
+    bool computeSimilarityMatrix(int fragmentMatchLength, bool exactMatchOnly, std::ostream& output) const;
     // We prevent a GenomeMatcher object from being copied or assigned.
     GenomeMatcher(const GenomeMatcher&) = delete;
     GenomeMatcher& operator=(const GenomeMatcher&) = delete;
-    
+
 private:
     GenomeMatcherImpl* m_impl;
 };